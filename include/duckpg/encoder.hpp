@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+
+#include <duckdb.hpp>
+
+#include <pgwire/types.hpp>
+#include <pgwire/writer.hpp>
+
+namespace duckdb {
+
+struct TypeEncoder;
+
+// encodes the value at index of a vector, the index is already resolved
+// through the vector's selection vector and the value is known to be valid
+using ValueEncoder = void (*)(pgwire::RowWriter &row,
+                              TypeEncoder const &encoder,
+                              RecursiveUnifiedVectorFormat const &format,
+                              idx_t index);
+
+// TypeEncoder is resolved once per type, nested types have one for their
+// list element or for every struct field
+struct TypeEncoder {
+    LogicalType type;
+    pgwire::Oid oid = pgwire::Oid::Unknown;
+    ValueEncoder encode = nullptr;
+    std::vector<TypeEncoder> children;
+};
+
+// oid the values of type are sent as, Unknown when they can't be encoded
+pgwire::Oid type_oid(LogicalType const &type);
+
+// ResultEncoder writes DataChunks as DataRows. The encoder of every column
+// is resolved once per statement, the chunks are then read straight from
+// their vectors without going through Value. Types without an encoder, e.g.
+// enums or maps, are sent as text in the form DuckDB prints them.
+class ResultEncoder {
+  public:
+    // adds the column at index of the chunks to the rows, returns the oid its
+    // values are sent as
+    pgwire::Oid add_column(idx_t index, LogicalType const &type);
+    std::size_t num_columns() const;
+
+    // encode flushes the writer between the rows, it stops and returns false
+    // once the rows can't be sent anymore
+    bool encode(DataChunk &chunk, pgwire::Writer &writer);
+
+  private:
+    // an encoded value in Column::cells
+    struct Cell {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    struct Column {
+        idx_t index;
+        TypeEncoder encoder;
+        // no encoder for the type, the values go through Value::ToString
+        bool as_text = false;
+        // the column of the chunk being encoded
+        RecursiveUnifiedVectorFormat format;
+        // constant and dictionary vectors repeat their values, each one is
+        // encoded once per chunk and copied into the other rows
+        bool repeats = false;
+        vector<Cell> cell_index;
+        pgwire::Bytes cells;
+    };
+
+    // decides whether the values of the column repeat in the chunk
+    static void prepare_cells(Column &column, Vector &vector, idx_t count);
+    static void encode_cell(pgwire::RowWriter &row, Column &column,
+                            idx_t row_idx);
+
+    vector<Column> _columns;
+};
+
+} // namespace duckdb
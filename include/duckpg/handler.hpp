@@ -0,0 +1,35 @@
+#pragma once
+
+#include <duckdb.hpp>
+
+#include <chrono>
+#include <optional>
+#include <string_view>
+
+#include <pgwire/session.hpp>
+
+namespace duckdb {
+
+// how the statements of the sessions are run
+enum class ExecutionMode {
+    // prepare, execute and fetch run on a bounded pool of workers
+    Workers,
+    // statements are prepared on the workers, their pending query is then
+    // stepped on the session's I/O thread in time slices between the other
+    // sessions and the result is fetched on the workers
+    Stepping,
+};
+
+// duckdb_handler serves a session with its own connection to db
+pgwire::AsyncParseHandler duckdb_handler(DatabaseInstance &db,
+                                         pgwire::Session &session,
+                                         asio::thread_pool &workers,
+                                         ExecutionMode mode);
+
+// DuckDB has no statement_timeout, SET and RESET of it are kept by the
+// session instead. Returns the timeout query sets if it is one of them,
+// throws a SqlException if the value is not a valid timeout.
+std::optional<std::chrono::milliseconds>
+statement_timeout(std::string_view query);
+
+} // namespace duckdb
@@ -1,21 +1,75 @@
 #pragma once
 
+#include <cstring>
 #include <string>
+#include <string_view>
 
 #include <endian/network.hpp>
 #include <pgwire/types.hpp>
 #include <type_traits>
 
 namespace pgwire {
+
+// BufferPool keeps the storage of sent buffers around on the current thread,
+// so encoding the next messages doesn't need to go through the allocator
+class BufferPool {
+  public:
+    // bigger chunks are not kept, they would pin the memory of a single big
+    // result
+    static constexpr std::size_t kMaxChunkSize = 64 * 1024;
+    static constexpr std::size_t kMaxChunks = 64;
+
+    // acquire returns empty bytes with at least the given capacity
+    static Bytes acquire(std::size_t capacity = 0);
+    static void release(Bytes &&bytes);
+    // number of chunks waiting to be reused on the current thread
+    static std::size_t available();
+};
+
+struct ArenaStats {
+    std::size_t acquired = 0;   // chunks handed out
+    std::size_t reused = 0;     // of them, chunks that were recycled
+    std::size_t in_use = 0;     // chunks handed out and not released yet
+    std::size_t high_water = 0; // most chunks in use at once
+    std::size_t retained_bytes = 0;   // capacity of the chunks kept for reuse
+    std::size_t high_water_bytes = 0; // most capacity kept at once
+    std::size_t resets = 0;
+
+    // fraction of the chunks that didn't need an allocation
+    double reuse_rate() const;
+};
+
+// BufferArena recycles the chunks of a single session. Chunks are released
+// once they are written, and on reset the ones beyond what the last query
+// needed go back to the thread's pool
+class BufferArena {
+  public:
+    Bytes acquire(std::size_t capacity = 0);
+    void release(Bytes &&bytes);
+    // reset is called at query boundaries
+    void reset();
+    ArenaStats const &stats() const;
+
+  private:
+    std::vector<Bytes> _free;
+    // most chunks in use at once since the last reset
+    std::size_t _peak = 0;
+    ArenaStats _stats;
+};
+
 class Buffer {
   public:
     Buffer() = default;
     Buffer(Bytes &&data);
+    // pooled returns a buffer backed by a chunk of the thread's pool, release
+    // the bytes once they are sent to give it back
+    static Buffer pooled(std::size_t capacity = 0);
 
     inline Bytes const &data() const { return _data; }
 
     Bytes take_bytes();
     size_t size() const;
+    void clear();
 
     Bytes::const_iterator begin() const;
     Bytes::const_iterator end() const;
@@ -26,8 +80,17 @@ class Buffer {
 
     template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
     T get_numeric();
+    // get_string returns the next null terminated string without the null,
+    // throws protocol violation when there is no null
     std::string get_string();
 
+    void reserve(std::size_t n);
+    // extend grows the data by n bytes and returns where to write them, the
+    // pointer is valid until the next put
+    Byte *extend(std::size_t n);
+    // truncate drops the data after n bytes, e.g. unused room from extend
+    void truncate(std::size_t n);
+
     Buffer &put_byte(Byte b);
     Buffer &put_bytes(Bytes const &bytes);
     Buffer &put_bytes(Byte const *b, std::size_t size);
@@ -37,26 +100,86 @@ class Buffer {
     std::enable_if_t<std::is_integral_v<T> || std::is_floating_point_v<T>,
                      Buffer &>
     put_numeric(T v);
+    // overwrites a value put before at offset of the data, e.g. a length that
+    // is only known once the rest is written
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    void set_numeric(size_t offset, T v);
 
   private:
     Bytes _data;
     size_t _pos = 0;
 };
 
+// BufferView reads from bytes owned by someone else, strings are returned as
+// views into them so nothing is copied while decoding
+class BufferView {
+  public:
+    BufferView() = default;
+    BufferView(Byte const *data, size_t size);
+
+    size_t size() const;
+    Byte const *buffer() const;
+    inline Byte at(size_t n) const { return _data[_pos + n]; };
+    void advance(size_t n);
+
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    T get_numeric();
+    // get_string returns the next null terminated string without the null,
+    // throws protocol violation when there is no null
+    std::string_view get_string();
+    std::string_view get_bytes(size_t n);
+
+  private:
+    // ensure n bytes are available, throws protocol violation otherwise
+    void require(size_t n) const;
+
+  private:
+    Byte const *_data = nullptr;
+    size_t _size = 0;
+    size_t _pos = 0;
+};
+
 template <typename T, typename> T Buffer::get_numeric() {
     T result = endian::network::get<T>(buffer());
     advance(sizeof(T));
     return result;
 };
 
+template <typename T, typename> T BufferView::get_numeric() {
+    require(sizeof(T));
+    T result = endian::network::get<T>(buffer());
+    advance(sizeof(T));
+    return result;
+};
+
+// the vector grows geometrically on resize, so appends are amortized, and
+// the new bytes are left uninitialized for the caller to write
+inline Byte *Buffer::extend(std::size_t n) {
+    auto size = _data.size();
+    _data.resize(size + n);
+    return _data.data() + size;
+}
+
+inline Buffer &Buffer::put_byte(Byte b) {
+    _data.push_back(b);
+    return *this;
+}
+
+inline Buffer &Buffer::put_bytes(Byte const *b, std::size_t size) {
+    if (size > 0) {
+        std::memcpy(extend(size), b, size);
+    }
+    return *this;
+}
+
 template <typename T>
 std::enable_if_t<std::is_integral_v<T> || std::is_floating_point_v<T>, Buffer &>
 Buffer::put_numeric(T v) {
-    T buffer = 0;
-    endian::network::put(v, reinterpret_cast<uint8_t *>(&buffer));
-    auto pointer = reinterpret_cast<uint8_t *>(&buffer);
-    std::copy(pointer, pointer + sizeof(T), std::back_inserter(_data));
-
+    endian::network::put(v, extend(sizeof(T)));
     return *this;
 }
+
+template <typename T, typename> void Buffer::set_numeric(size_t offset, T v) {
+    endian::network::put(v, _data.data() + offset);
+}
 } // namespace pgwire
\ No newline at end of file
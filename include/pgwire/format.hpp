@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <pgwire/types.hpp>
+
+namespace pgwire {
+
+// enough room for the text of any value formatted below
+constexpr std::size_t kMaxNumericTextSize = 32;
+
+// The format_* functions write the postgres text representation of a value
+// into out, which must hold at least kMaxNumericTextSize chars, and return
+// the number of chars written. Nothing is allocated and no null terminator
+// is written.
+std::size_t format_int2(char *out, int16_t v);
+std::size_t format_int4(char *out, int32_t v);
+std::size_t format_int8(char *out, int64_t v);
+
+// floats are written with the shortest digits that read back to the same
+// value, the same as postgres with extra_float_digits > 0. Fixed notation
+// is used when -4 <= exponent < 15 (6 for float4), e.g. 0.0001, 1e-05,
+// 123456, 1e+15, NaN, Infinity and -Infinity.
+std::size_t format_float4(char *out, float v);
+std::size_t format_float8(char *out, double v);
+
+// enough room for the text of any date, time or interval formatted below
+constexpr std::size_t kMaxTemporalTextSize = 80;
+
+// Temporal values are taken in DuckDB's representation, days or
+// microseconds since 1970-01-01, and written in the postgres ISO DateStyle,
+// e.g. 2024-02-29, 13:45:00.25, 0044-03-15 12:00:00 BC. DuckDB's infinite
+// dates and timestamps, the int max and its negation, are written as
+// infinity and -infinity.
+std::size_t format_date(char *out, int32_t days);
+std::size_t format_time(char *out, int64_t micros);
+std::size_t format_timestamp(char *out, int64_t micros);
+// the session reports UTC as its TimeZone, so the offset is always +00
+std::size_t format_timestamptz(char *out, int64_t micros);
+// interval in the postgres IntervalStyle, e.g. 1 year 2 mons 3 days 04:05:06
+// or -1 days +01:00:00
+std::size_t format_interval(char *out, int32_t months, int32_t days,
+                            int64_t micros);
+
+// 128 bit two's complement integer, e.g. the unscaled value of a numeric
+struct Int128 {
+    uint64_t lower;
+    int64_t upper;
+};
+
+// enough room for the text of any numeric with up to 38 digits of scale
+constexpr std::size_t kMaxDecimalTextSize = 48;
+// enough room for the binary numeric of any Int128 value
+constexpr std::size_t kMaxDecimalBinarySize = 32;
+
+// numeric of v / 10^scale, the text keeps every digit of the scale like
+// postgres does, e.g. 1.50 for 150 with scale 2
+std::size_t format_decimal(char *out, Int128 v, uint8_t scale);
+// postgres' binary numeric, i.e. ndigits, weight, sign and dscale followed
+// by the base 10000 digits, all as network order int16
+std::size_t encode_decimal(Byte *out, Int128 v, uint8_t scale);
+
+constexpr std::size_t kUuidTextSize = 36;
+
+// the 16 bytes of an uuid as xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx
+std::size_t format_uuid(char *out, Byte const *bytes);
+
+// lowercase hex digits of the bytes, 2 * size chars are written. Uses the
+// widest SIMD kernel supported by the cpu, picked once at startup.
+void format_hex(char *out, Byte const *data, std::size_t size);
+
+enum class HexKernel { Scalar, Sse2, Avx2 };
+
+// kernel used by format_hex
+HexKernel hex_kernel();
+bool hex_kernel_supported(HexKernel kernel);
+// format_hex with the given kernel, which must be supported
+void format_hex(char *out, Byte const *data, std::size_t size,
+                HexKernel kernel);
+
+} // namespace pgwire
@@ -46,24 +46,12 @@ inline void set_promise(Defer defer, error_code err, const Result &result) {
 template <typename Stream, typename Buffer>
 inline Promise async_write(Stream &stream, Buffer const &buffer) {
     return newPromise([&](Defer &defer) {
-        auto actual_size = buffer_size(buffer);
-        // actual write
+        // asio::async_write completes once everything is written or on error,
+        // a partial write is always an error
         asio::async_write(
             stream, buffer,
-            [defer, &stream, buffer,
-             actual_size](error_code err, std::size_t bytes_transferred) {
-                if (bytes_transferred == actual_size) {
-                    set_promise(defer, err, bytes_transferred);
-                } else {
-                    auto current_buffer =
-                        asio::buffer(buffer + bytes_transferred,
-                                     actual_size - bytes_transferred);
-                    async_write(stream, current_buffer)
-                        .then([defer, bytes_transferred](std::size_t len) {
-                            defer.resolve(bytes_transferred + len);
-                        })
-                        .fail([defer](error_code err) { defer.reject(err); });
-                }
+            [defer](error_code err, std::size_t bytes_transferred) {
+                set_promise(defer, err, bytes_transferred);
             });
     });
 }
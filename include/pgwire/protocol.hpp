@@ -3,19 +3,22 @@
 #include <asio.hpp>
 #include <endian/network.hpp>
 
+#include <array>
 #include <cinttypes>
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include <pgwire/buffer.hpp>
 #include <pgwire/types.hpp>
 
 namespace pgwire {
 
-struct BackendMessage;
 struct FrontendMessage;
 
 enum class FrontendTag : MessageTag {
@@ -63,51 +66,15 @@ enum class BackendTag : MessageTag {
     RowDescription = 'T',
 };
 
-struct SSLResponse;
-
-void encode(Buffer &b, BackendMessage const &msg);
-void encode(Buffer &b, SSLResponse const &ssl_resp);
-
-template <typename T> Bytes encode_bytes(T const &t) {
-    Buffer b;
-    encode(b, t);
-    return b.take_bytes();
-}
-
-struct BackendMessage {
-    virtual BackendTag tag() const noexcept = 0;
-    virtual void encode(Buffer &b) const = 0;
-};
-
 struct SSLResponse {
     bool support = false;
 };
 
-struct AuthenticationOk : public BackendMessage {
-    BackendTag tag() const noexcept override;
-    void encode(Buffer &b) const override;
-};
-
-struct ParameterStatus : public BackendMessage {
-    std::string name;
-    std::string value;
-
-    ParameterStatus() = default;
-    ParameterStatus(std::string name, std::string value);
-
-    BackendTag tag() const noexcept override;
-    void encode(Buffer &b) const override;
-};
+void encode(Buffer &b, SSLResponse const &ssl_resp);
 
-struct ReadyForQuery : public BackendMessage {
+// transaction status ReadyForQuery reports, see ready_for_query
+struct ReadyForQuery {
     enum Status { Idle, Block, Failed };
-    Status status = Idle;
-
-    ReadyForQuery() = default;
-    ReadyForQuery(Status status);
-
-    BackendTag tag() const noexcept override;
-    void encode(Buffer &b) const override;
 };
 
 struct FieldDescription {
@@ -117,74 +84,190 @@ struct FieldDescription {
 
 using Fields = std::vector<FieldDescription>;
 
-struct RowDescription : public BackendMessage {
-    Fields fields;
-    FormatCode format_code;
-
-    RowDescription() = default;
-    RowDescription(Fields fields, FormatCode format_code = FormatCode::Text);
+// format code of the nth value out of a list of format codes as sent in Bind,
+// none means text, a single one applies to every value
+FormatCode format_code_at(std::vector<FormatCode> const &format_codes,
+                          std::size_t n);
+
+// Messages known at compile time are kept as their encoded bytes, and the
+// others are written straight from their fields with put_message, so nothing
+// is built just to be serialized
+template <BackendTag Tag, Byte... Body>
+constexpr std::array<Byte, 5 + sizeof...(Body)> constant_message() {
+    constexpr uint32_t length = 4 + sizeof...(Body);
+    return {Byte(Tag),           Byte(length >> 24), Byte(length >> 16),
+            Byte(length >> 8),   Byte(length),       Body...};
+}
 
-    BackendTag tag() const noexcept override;
-    void encode(Buffer &b) const override;
+inline constexpr auto kAuthenticationOk =
+    constant_message<BackendTag::Authentication, 0, 0, 0, 0>();
+inline constexpr auto kParseComplete =
+    constant_message<BackendTag::ParseComplete>();
+inline constexpr auto kBindComplete =
+    constant_message<BackendTag::BindComplete>();
+inline constexpr auto kCloseComplete =
+    constant_message<BackendTag::CloseComplete>();
+inline constexpr auto kNoData = constant_message<BackendTag::NoData>();
+inline constexpr auto kPortalSuspended =
+    constant_message<BackendTag::PortalSuspended>();
+inline constexpr auto kEmptyQueryResponse =
+    constant_message<BackendTag::EmptyQueryResponse>();
+inline constexpr std::array<Byte, 6> kReadyForQuery[] = {
+    constant_message<BackendTag::ReadyForQuery, 'I'>(),
+    constant_message<BackendTag::ReadyForQuery, 'T'>(),
+    constant_message<BackendTag::ReadyForQuery, 'E'>(),
 };
 
-struct CommandComplete : public BackendMessage {
-    std::string command_tag;
+constexpr std::array<Byte, 6> const &
+ready_for_query(ReadyForQuery::Status status) {
+    return kReadyForQuery[status];
+}
 
-    CommandComplete() = default;
-    CommandComplete(std::string command_tag);
+template <std::size_t N>
+void encode(Buffer &b, std::array<Byte, N> const &message) {
+    b.put_bytes(message.data(), N);
+}
 
-    BackendTag tag() const noexcept override;
-    void encode(Buffer &b) const override;
-};
+// fields of put_message, strings are null terminated and numbers are in
+// network order
+constexpr std::size_t field_size(std::string_view v) { return v.size() + 1; }
+template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+constexpr std::size_t field_size(T) {
+    return sizeof(T);
+}
 
-struct ErrorResponse : public BackendMessage {
-    std::string message;
-    ErrorSeverity severity = ErrorSeverity::Error;
-    SqlState sql_state = SqlState::ProtocolViolation;
+inline void put_field(Buffer &b, std::string_view v) { b.put_string(v); }
+template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+void put_field(Buffer &b, T v) {
+    b.put_numeric<T>(v);
+}
 
-    ErrorResponse() = default;
-    ErrorResponse(std::string message, SqlState state,
-                  ErrorSeverity severity = ErrorSeverity::Error);
+// put_message writes a message made of the given fields, the length is known
+// upfront so it's written in a single pass, e.g.
+// put_message(b, BackendTag::CommandComplete, "SELECT 1")
+template <typename... Fields>
+void put_message(Buffer &b, BackendTag tag, Fields const &...fields) {
+    std::size_t length = sizeof(int32_t) + (field_size(fields) + ... + 0);
+    b.reserve(1 + length);
+    b.put_numeric<uint8_t>(uint8_t(tag));
+    b.put_numeric<int32_t>(int32_t(length));
+    (put_field(b, fields), ...);
+}
 
-    BackendTag tag() const noexcept override;
-    void encode(Buffer &b) const override;
-};
+// descriptions are written from the statement's fields and types as they are
+void put_row_description(Buffer &b, Fields const &fields,
+                         std::vector<FormatCode> const &format_codes = {});
+void put_parameter_description(Buffer &b, std::vector<Oid> const &types);
 
+// FrontendMessage fields are views into the receive buffer, storage keeps
+// that buffer alive for as long as the message is
 struct FrontendMessage {
+    std::shared_ptr<Bytes const> storage;
+
     virtual ~FrontendMessage() = default;
     virtual FrontendType type() const noexcept = 0;
     virtual FrontendTag tag() const noexcept = 0;
-    virtual void decode(Buffer &) = 0;
+    virtual void decode(BufferView &) = 0;
 };
 
 using FrontendMessagePtr = std::shared_ptr<FrontendMessage>;
 
 struct StartupMessage : public FrontendMessage {
     bool is_ssl_request = false;
+    bool is_cancel_request = false;
+    // BackendKeyData of the session a CancelRequest is for
+    int32_t process_id = 0;
+    int32_t secret_key = 0;
     int16_t major_version = 0;
     int16_t minor_version = 0;
-    std::string user;
-    std::string database;
-    std::string options; // deprecated
+    std::string_view user;
+    std::string_view database;
+    std::string_view options; // deprecated
 
     FrontendType type() const noexcept override;
     FrontendTag tag() const noexcept override;
-    void decode(Buffer &) override;
+    void decode(BufferView &) override;
 };
 
 struct Query : public FrontendMessage {
-    std::string query;
+    std::string_view query;
+
+    FrontendType type() const noexcept override;
+    FrontendTag tag() const noexcept override;
+    void decode(BufferView &) override;
+};
+
+struct Parse : public FrontendMessage {
+    std::string_view name;
+    std::string_view query;
+    std::vector<oid_t> parameter_types;
+
+    FrontendType type() const noexcept override;
+    FrontendTag tag() const noexcept override;
+    void decode(BufferView &) override;
+};
+
+struct Bind : public FrontendMessage {
+    std::string_view portal;
+    std::string_view statement;
+    std::vector<FormatCode> parameter_formats;
+    std::vector<std::optional<std::string_view>> parameters; // null is nullopt
+    std::vector<FormatCode> result_formats;
+
+    FrontendType type() const noexcept override;
+    FrontendTag tag() const noexcept override;
+    void decode(BufferView &) override;
+};
+
+// Describe and Close target either a prepared statement or a portal
+enum class DescribeTarget : Byte {
+    Statement = 'S',
+    Portal = 'P',
+};
+
+struct Describe : public FrontendMessage {
+    DescribeTarget target = DescribeTarget::Statement;
+    std::string_view name;
+
+    FrontendType type() const noexcept override;
+    FrontendTag tag() const noexcept override;
+    void decode(BufferView &) override;
+};
+
+struct Execute : public FrontendMessage {
+    std::string_view portal;
+    int32_t max_rows = 0; // 0 means no limit
+
+    FrontendType type() const noexcept override;
+    FrontendTag tag() const noexcept override;
+    void decode(BufferView &) override;
+};
+
+struct Close : public FrontendMessage {
+    DescribeTarget target = DescribeTarget::Statement;
+    std::string_view name;
+
+    FrontendType type() const noexcept override;
+    FrontendTag tag() const noexcept override;
+    void decode(BufferView &) override;
+};
+
+struct Sync : public FrontendMessage {
+    FrontendType type() const noexcept override;
+    FrontendTag tag() const noexcept override;
+    void decode(BufferView &) override;
+};
 
+struct Flush : public FrontendMessage {
     FrontendType type() const noexcept override;
     FrontendTag tag() const noexcept override;
-    void decode(Buffer &) override;
+    void decode(BufferView &) override;
 };
 
 struct Terminate : public FrontendMessage {
     FrontendType type() const noexcept override;
     FrontendTag tag() const noexcept override;
-    void decode(Buffer &) override;
+    void decode(BufferView &) override;
 };
 
 } // namespace pgwire
@@ -5,11 +5,19 @@
 namespace pgwire {
 
 using Handler = std::function<ParseHandler(Session &session)>;
+using AsyncHandler = std::function<AsyncParseHandler(Session &session)>;
 class ServerImpl;
 class Server {
   public:
+    // num_threads controls how many I/O threads serve the clients, each of
+    // them owns an io_context and an acceptor bound with SO_REUSEPORT so the
+    // kernel spreads incoming connections across threads. A session stays on
+    // the thread that accepted it. The first thread always uses io_context.
     Server(asio::io_context &io_context, asio::ip::tcp::endpoint endpoint,
-           Handler &&handler);
+           Handler &&handler, std::size_t num_threads = 1);
+    // sessions are served by asynchronous parse handlers
+    Server(asio::io_context &io_context, asio::ip::tcp::endpoint endpoint,
+           AsyncHandler &&handler, std::size_t num_threads = 1);
     ~Server();
     void start();
 
@@ -1,7 +1,14 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
 #include <optional>
+#include <unordered_map>
 
+#include <pgwire/exception.hpp>
 #include <pgwire/io.hpp>
 #include <pgwire/protocol.hpp>
 #include <pgwire/types.hpp>
@@ -18,34 +25,326 @@ class ServerImpl;
 class Session;
 struct PreparedStatement;
 
-using Value = std::string;
+class AsyncResult;
+struct Cursor;
+
+using Value = std::optional<std::string>; // parameters in text format
 using Values = std::vector<Value>;
-using ExecHandler =
-    fu2::unique_function<void(Writer &writer, Values const &arguments)>;
-using ParseHandler = std::function<PreparedStatement(std::string const &)>;
+using Executor = asio::any_io_executor;
 using SessionID = std::size_t;
 using SessionPtr = std::shared_ptr<Session>;
+using AsyncResultPtr = std::shared_ptr<AsyncResult>;
+
+// Completion hands the outcome of an asynchronous handler back to the
+// session. It may be completed from any thread, only the first call counts,
+// and the session resumes on its own executor.
+template <typename T> class Completion {
+  public:
+    using Callback =
+        fu2::unique_function<void(std::optional<T> value, SqlExceptionPtr)>;
+
+    Completion(Executor executor, Callback &&callback);
+
+    void resolve(T value) const;
+    void reject(SqlException error) const;
+
+  private:
+    struct State {
+        Executor executor;
+        Callback callback;
+        std::atomic<bool> done = false;
+    };
+    void complete(std::optional<T> value, SqlExceptionPtr error) const;
+
+    std::shared_ptr<State> _state;
+};
+
+// handlers run on the session's I/O thread and block it while they run.
+// The rows of an exec handler are written to the client as they reach the
+// writer's flush threshold, blocking until the client took them.
+using ExecHandler =
+    fu2::unique_function<void(Writer &writer, Values const &arguments)>;
+using ParseHandler =
+    std::function<PreparedStatement(std::string_view query)>;
+
+// asynchronous handlers return right away and complete later, possibly from
+// another thread, so the I/O thread keeps serving other sessions. Arguments
+// are only valid during the call.
+using AsyncExecHandler =
+    fu2::unique_function<void(AsyncResultPtr result, Values const &arguments)>;
+using AsyncParseHandler = std::function<void(
+    std::string_view query, Completion<PreparedStatement> done)>;
+// CancelHandler interrupts the running statement, it is called from
+// whichever thread cancels it and the statement is expected to fail soon
+using CancelHandler = std::function<void()>;
 
 struct PreparedStatement {
     Fields fields;
+    // command of the CommandComplete tag, e.g. INSERT or CREATE TABLE, the
+    // commands counting rows are followed by Writer::rows_affected. The
+    // empty query has no command and gets an EmptyQueryResponse instead.
+    std::string command = "SELECT";
+    // either one is set, the asynchronous one takes precedence
     ExecHandler handler;
+    AsyncExecHandler async_handler;
+    // types of the parameters, unknown parameters may be left out
+    std::vector<Oid> parameter_types;
 };
 
-class Session {
+// AsyncResult is handed to asynchronous exec handlers. Its writer may be
+// used from any thread, by one producer at a time. Full batches of rows are
+// sent on the session's executor by Writer::flush while the producer goes
+// on. An asynchronous producer is never held back, since it would hold
+// whichever thread runs it, it checks writable between batches of work and
+// carries on from on_writable. finish or fail completes the statement.
+class AsyncResult : public std::enable_shared_from_this<AsyncResult> {
   public:
+    // batches of rows that may be queued before the producer waits
+    static constexpr std::size_t kMaxQueuedBatches = 4;
+
+    AsyncResult(SessionPtr session, std::size_t num_cols,
+                std::vector<FormatCode> const &format_codes);
+
+    Writer &writer();
+    void finish();
+    void fail(SqlException error);
+    // cancelled is true once the rows can't be sent anymore, e.g. the client
+    // is gone, the producer should stop and finish
+    bool cancelled() const;
+    // interrupted is true once the statement is cancelled. The cancel
+    // handler is called right away, a producer that can only be interrupted
+    // once its work started checks it then.
+    bool interrupted() const;
+    // writable is false while kMaxQueuedBatches are queued
+    bool writable() const;
+    // on_writable calls callback once the result is writable or cancelled,
+    // right away if it already is, otherwise on the session's executor
+    void on_writable(fu2::unique_function<void()> &&callback);
+
+  private:
+    friend class Session;
+
+    // send_batch queues a batch of rows, false once they can't be sent. The
+    // rows are moved out of data, which is left with a spare chunk.
+    bool send_batch(Bytes &data);
+    void complete(SqlExceptionPtr error);
+    // cancel stops the producer of a portal that is closed while suspended
+    void cancel();
+
+    SessionPtr _session;
+    Writer _writer;
+    // set when the result belongs to a portal run with a row limit, the
+    // batches are held by the cursor instead of being written
+    std::shared_ptr<Cursor> _cursor;
+    // set by the session, called on its executor once the result completes
+    fu2::unique_function<void(SqlExceptionPtr)> _done;
+
+    mutable std::mutex _mutex;
+    std::size_t _queued = 0;
+    bool _cancelled = false;
+    // chunks of the session's arena the writer goes on in after a batch
+    std::vector<Bytes> _spare;
+    fu2::unique_function<void()> _on_writable;
+    std::atomic<bool> _completed = false;
+};
+
+using PreparedStatementPtr = std::shared_ptr<PreparedStatement>;
+
+// Cursor is the execution of a portal run by an Execute with max_rows. The
+// rows past the limit of an Execute are held until the next one, the
+// portal is suspended meanwhile. An asynchronous producer waits once
+// AsyncResult::kMaxQueuedBatches are held, a synchronous one can't be held
+// back so its whole result is kept.
+struct Cursor {
+    struct Batch {
+        Bytes rows;
+        std::size_t offset = 0; // the rows before it are sent
+        fu2::unique_function<void(io::error_code)> written;
+    };
+
+    PreparedStatementPtr statement;
+    AsyncResultPtr result;
+    std::deque<Batch> batches;
+    std::size_t limit = 0; // rows the running Execute may still send
+    std::size_t sent = 0;  // rows the running Execute sent
+    bool suspended = false;
+    // the running Execute waits for the producer
+    bool waiting = false;
+    // the producer completed, with error if it failed
+    bool completed = false;
+    SqlExceptionPtr error;
+    std::size_t rows_affected = 0;
+    // CommandComplete or the error is sent, or the portal is closed
+    bool finished = false;
+};
+
+// Portal is a prepared statement bound to its parameters
+struct Portal {
+    PreparedStatementPtr statement;
+    Values parameters;
+    std::vector<FormatCode> result_formats;
+    // set once an Execute limited its rows, until the portal is done
+    std::shared_ptr<Cursor> cursor;
+};
+
+struct SessionStats {
+    std::size_t read_calls = 0;       // read syscalls issued on the socket
+    std::size_t messages_decoded = 0; // frontend messages sliced out of them
+};
+
+class Session : public std::enable_shared_from_this<Session> {
+  public:
+    // number of frontend message types that are decoded into cached messages
+    static constexpr std::size_t kMessageSlots = 16;
+
     Session(SessionID id, asio::ip::tcp::socket &&socket);
     ~Session();
 
     Promise start();
+#ifdef PGWIRE_USE_COROUTINES
+    // run serves the session until it is closed, the coroutine alternative
+    // to start
+    asio::awaitable<void> run();
+#endif
     Promise process_message(FrontendMessagePtr msg);
     SessionID id() const;
+    SessionStats const &stats() const;
+    ArenaStats const &arena_stats() const;
+
+    // transaction status reported by ReadyForQuery, handlers that support
+    // transactions keep it up to date
+    ReadyForQuery::Status transaction_status() const;
+    void set_transaction_status(ReadyForQuery::Status status);
+    // executor of the session's I/O thread
+    Executor executor();
+
+    // secret key of the session, sent to the client in BackendKeyData
+    int32_t secret_key() const;
+    // cancel interrupts the running statement if key is the session's secret
+    // key, it may be called from any thread. The statement fails with
+    // QueryCanceled.
+    void cancel(int32_t key);
+    void set_cancel_handler(CancelHandler &&handler);
+    // statements running longer than timeout are cancelled, zero disables
+    // it. Synchronous handlers block the I/O thread the timer runs on, so
+    // only asynchronous ones are interrupted.
+    void set_statement_timeout(std::chrono::milliseconds timeout);
 
   private:
+    friend class AsyncResult;
+
+    // what the session does once a message is handled, Wait means an
+    // asynchronous handler runs and resume is called with the next step
+    enum class Step { Read, Flush, Ready, Close, Wait };
+    // why the running statement is cancelled
+    enum class Cancel { None, UserRequest, StatementTimeout };
+    using FlushWaiter = fu2::unique_function<void(io::error_code)>;
+    using Next = fu2::unique_function<Step()>;
+
     void set_handler(ParseHandler &&handler);
+    void set_handler(AsyncParseHandler &&handler);
+    // follow carries out the step of the promise based loop
+    Promise follow(Step step);
+    void resume(Step step);
+    // fail reports the error of an asynchronous handler, extended tells
+    // whether it happened in the extended query protocol
+    Step fail(SqlException const &e, bool extended);
     void do_read(Defer defer);
+    // handle serves the message and queues the responses, errors are thrown
+    // as SqlException
+    Step handle(FrontendMessage &msg);
     Promise read();
-    Promise read_startup();
-    Promise write(Bytes &&b);
+    // receive reads whatever the socket has into the receive buffer
+    Promise receive();
+    // prepare_receive makes room in the receive buffer for the next read
+    void prepare_receive();
+#ifdef PGWIRE_USE_COROUTINES
+    asio::awaitable<bool> co_receive();
+    // co_resume waits for the running asynchronous handler
+    asio::awaitable<Step> co_resume();
+    // co_flush is flush for the coroutine loop, false if the write failed
+    asio::awaitable<bool> co_flush();
+    // co_ready is ready for the coroutine loop
+    asio::awaitable<bool> co_ready();
+#endif
+    // decode slices one complete message out of the receive buffer, returns
+    // false when the buffer does not hold a complete message yet
+    bool decode(FrontendMessagePtr &message);
+
+    // write queues the message, it is sent on the next flush or once the
+    // queued messages exceed the cork threshold
+    void write(Bytes &&b);
+    // send encodes the message into a chunk of the session's arena and
+    // queues it
+    template <typename T> void send(T const &msg);
+    // send_message is send for messages written with put_message
+    template <typename... Fields>
+    void send_message(BackendTag tag, Fields const &...fields);
+    // emit queues whatever put writes into a chunk of the session's arena
+    template <typename Put> void emit(Put &&put);
+    void send_error(SqlException const &e);
+    // ready ends the query with ReadyForQuery and flushes, the arena is
+    // reset once everything is written. Both session loops end their
+    // queries with it, the promise based one through the returned promise.
+    Promise ready();
+    void ready(FlushWaiter &&done);
+    // flush sends every queued message with a single gather write, the
+    // returned promise is resolved once all of them are written
+    Promise flush();
+    // flush calls written once the queued messages are written
+    void flush(FlushWaiter &&written);
+    void do_flush();
+
+    // extended query protocol, errors are thrown as SqlException
+    Step handle_parse(Parse const &msg);
+    void handle_bind(Bind const &msg);
+    void handle_describe(Describe const &msg);
+    Step handle_execute(Execute const &msg);
+    void handle_close(Close const &msg);
+    // close_portal stops the portal's producer if it is suspended
+    void close_portal(Portal &portal);
+    void close_portals();
+    // prepare calls the parse handler, then with the statement
+    Step prepare(std::string_view query,
+                 fu2::unique_function<Step(PreparedStatement &&)> &&then,
+                 bool extended);
+    // execute writes the rows followed by CommandComplete, then
+    Step execute(PreparedStatementPtr statement, Values const &parameters,
+                 std::vector<FormatCode> const &result_formats, Next &&then,
+                 bool extended);
+    // execute_sync runs a synchronous exec handler right away, the session
+    // must not be writing
+    Step execute_sync(PreparedStatement &statement, Values const &parameters,
+                      std::vector<FormatCode> const &result_formats,
+                      Next &&then, bool extended);
+    // complete ends the statement with its rows and CommandComplete, or with
+    // the error, and continues with then
+    Step complete(PreparedStatement const &statement, Writer const &writer,
+                  SqlExceptionPtr error, Next &&then, bool extended);
+    // execute_cursor runs the portal until max_rows rows are sent, zero
+    // runs it to the end. The portal is suspended there and the next
+    // Execute carries on with the rest of its rows.
+    Step execute_cursor(Portal &portal, std::size_t max_rows);
+    // fetch sends the held rows of the cursor up to its limit, then suspends
+    // or completes the portal, or waits for the producer
+    Step fetch(Cursor &cursor);
+    // hold queues a batch of rows of the cursor, written is called once they
+    // are sent
+    void hold(Cursor &cursor, Bytes &&rows, FlushWaiter &&written);
+    void send_command_complete(std::string_view command,
+                               std::size_t num_rows);
+    // begin_statement and end_statement enclose the execution of a statement,
+    // only a running statement can be cancelled. end_statement returns why it
+    // was cancelled, if it was.
+    void begin_statement();
+    Cancel end_statement();
+    void interrupt(Cancel reason, std::size_t statement);
+    // write_batch queues rows of an asynchronous result, written is called
+    // once they are sent
+    void write_batch(Bytes &&b, FlushWaiter &&written);
+    // write_sync sends the queued messages followed by b and blocks until
+    // they are written, false if the write failed
+    bool write_sync(Bytes const &b);
 
   private:
     friend class Server;
@@ -55,6 +354,97 @@ class Session {
     bool _startup_done;
     asio::ip::tcp::socket _socket;
     std::optional<ParseHandler> _handler;
+    std::optional<AsyncParseHandler> _async_handler;
+    // continuation of the running asynchronous handler
+    fu2::unique_function<void(Step)> _resume;
+    SessionStats _stats;
+    ReadyForQuery::Status _transaction_status = ReadyForQuery::Idle;
+
+    // cancellation, the state is shared with the threads cancelling the
+    // session. _statement numbers the statements so a late timer can't
+    // cancel the next one.
+    int32_t _secret_key;
+    std::mutex _cancel_mutex;
+    CancelHandler _cancel_handler;
+    std::size_t _statement = 0;
+    bool _running = false;
+    Cancel _cancelled = Cancel::None;
+    std::chrono::milliseconds _statement_timeout{0};
+    asio::steady_timer _statement_timer;
+    // set by the server, finds the session a CancelRequest is for
+    std::function<void(SessionID id, int32_t key)> _cancel_request;
+
+    // chunks of the receive buffer and the outbound messages
+    BufferArena _arena;
+
+    // receive buffer, unread bytes are in [_recv_begin, _recv_end). Decoded
+    // messages share it, so it is only reused once none of them is alive
+    std::shared_ptr<Bytes> _recv;
+    std::size_t _recv_begin = 0;
+    std::size_t _recv_end = 0;
+    std::size_t _recv_needed = 0;
+    // decoded messages by slot, reused once they are processed
+    std::array<FrontendMessagePtr, kMessageSlots> _messages;
+
+    // named prepared statements and portals, the unnamed ones use ""
+    std::unordered_map<std::string, PreparedStatementPtr> _statements;
+    std::unordered_map<std::string, Portal> _portals;
+    // set after an error in the extended protocol, until the next Sync
+    bool _skip_till_sync = false;
+
+    // outbound queue, _inflight is owned by the running async_write
+    bool _writing = false;
+    std::size_t _pending_size = 0;
+    std::vector<Bytes> _pending;
+    std::vector<Bytes> _inflight;
+    std::vector<asio::const_buffer> _inflight_buffers;
+    std::vector<FlushWaiter> _flush_waiters;
+    std::vector<FlushWaiter> _inflight_waiters;
 };
 
+template <typename T>
+Completion<T>::Completion(Executor executor, Callback &&callback)
+    : _state(std::make_shared<State>()) {
+    _state->executor = std::move(executor);
+    _state->callback = std::move(callback);
+}
+
+template <typename T> void Completion<T>::resolve(T value) const {
+    complete(std::move(value), nullptr);
+}
+
+template <typename T> void Completion<T>::reject(SqlException error) const {
+    complete(std::nullopt, std::make_shared<SqlException>(std::move(error)));
+}
+
+template <typename T>
+void Completion<T>::complete(std::optional<T> value,
+                             SqlExceptionPtr error) const {
+    if (_state->done.exchange(true)) {
+        return;
+    }
+
+    // always posted, even from the I/O thread, so the session is never
+    // resumed from within the handler
+    asio::post(_state->executor, [state = _state, value = std::move(value),
+                                  error = std::move(error)]() mutable {
+        state->callback(std::move(value), std::move(error));
+    });
+}
+
+template <typename Put> void Session::emit(Put &&put) {
+    Buffer b{_arena.acquire()};
+    put(b);
+    write(b.take_bytes());
+}
+
+template <typename T> void Session::send(T const &msg) {
+    emit([&](Buffer &b) { encode(b, msg); });
+}
+
+template <typename... Fields>
+void Session::send_message(BackendTag tag, Fields const &...fields) {
+    emit([&](Buffer &b) { put_message(b, tag, fields...); });
+}
+
 } // namespace pgwire
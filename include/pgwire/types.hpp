@@ -1,11 +1,37 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
 #include <vector>
 namespace pgwire {
 
+// DefaultInitAllocator leaves the elements a vector grows by on resize
+// uninitialized, bytes are always written right after, so zeroing them first
+// would touch the memory twice
+template <typename T> struct DefaultInitAllocator : std::allocator<T> {
+    template <typename U> struct rebind {
+        using other = DefaultInitAllocator<U>;
+    };
+
+    DefaultInitAllocator() = default;
+    template <typename U>
+    DefaultInitAllocator(DefaultInitAllocator<U> const &) noexcept {}
+
+    template <typename U> void construct(U *p) noexcept {
+        ::new (static_cast<void *>(p)) U;
+    }
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&...args) {
+        ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
 using Byte = uint8_t;
-using Bytes = std::vector<Byte>;
+// ranges are copied in with memcpy rather than insert, which constructs them
+// one at a time with a custom allocator
+using Bytes = std::vector<Byte, DefaultInitAllocator<Byte>>;
 using MessageTag = Byte;
 
 using size_t = std::size_t;
@@ -15,6 +41,7 @@ enum class FrontendType {
     Invalid,
     Startup,
     SSLRequest,
+    CancelRequest,
     Bind,
     Close,
     CopyFail,
@@ -201,6 +228,10 @@ enum class SqlState {
     ProtocolViolation,
     SyntaxError,
     InvalidDatetimeFormat,
+    DuplicatePreparedStatement,
+    QueryCanceled,
+    InvalidParameterValue,
+    DuplicateCursor,
 };
 
 char const *get_sqlstate_code(SqlState state);
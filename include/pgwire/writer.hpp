@@ -1,6 +1,11 @@
 #pragma once
 
+#include <functional>
+#include <optional>
+#include <vector>
+
 #include <pgwire/buffer.hpp>
+#include <pgwire/format.hpp>
 #include <pgwire/protocol.hpp>
 #include <pgwire/types.hpp>
 
@@ -8,28 +13,74 @@ namespace pgwire {
 class Writer;
 class RowWriter;
 
+enum class NestedKind { Array, Record };
+
+// an array or record being written, the elements are collected before the
+// nested value is written into its parent
+struct NestedValue {
+    NestedKind kind = NestedKind::Array;
+    Oid element_oid = Oid::Unknown;
+    std::size_t count = 0;
+    bool has_null = false;
+    Buffer data;
+};
+
 void encode(Buffer &b, Writer const &writer);
 
+// FlushHandler receives the encoded DataRows, it may pause the producer
+// while the client falls behind and returns false once the rows can't be
+// sent anymore. It may take the rows and leave other bytes in their place,
+// the writer goes on in whatever data holds. It runs whenever a row is
+// finished, so it must not throw.
+using FlushHandler = std::function<bool(Bytes &data)>;
+
 class Writer {
   public:
     Writer(std::size_t num_cols, FormatCode format_code = FormatCode::Text);
+    // streaming writer, rows are handed to on_flush whenever the encoded
+    // rows reach flush_threshold bytes, so only the rest is kept around
+    // format_codes follow the Bind message rules, none means text for every
+    // column, a single one applies to every column, otherwise one per column
+    Writer(std::size_t num_cols, FlushHandler &&on_flush,
+           std::size_t flush_threshold,
+           std::vector<FormatCode> const &format_codes = {});
 
     RowWriter add_row();
+    // flush hands the rows to on_flush once they reach the threshold, every
+    // finished row calls it. False means the rows can't be sent anymore,
+    // e.g. the client is gone, the producer should stop and the rows written
+    // after that are dropped.
+    bool flush();
     std::size_t num_rows() const;
+    // rows_affected is the count CommandComplete reports, the rows written
+    // unless the command reports another one, e.g. the rows an UPDATE changed
+    void set_rows_affected(std::size_t rows);
+    std::size_t rows_affected() const;
+    FormatCode format_code(std::size_t col) const;
 
   private:
     friend void encode(Buffer &b, Writer const &writer);
     friend class RowWriter;
 
-    FormatCode _format_code = FormatCode::Text;
+    std::vector<FormatCode> _format_codes;
     std::size_t _num_cols = 0;
     std::size_t _num_rows = 0;
+    std::optional<std::size_t> _rows_affected;
     Buffer _data;
+    FlushHandler _on_flush;
+    std::size_t _flush_threshold = 0;
+    bool _failed = false;
+    // kept across rows so nested values reuse their buffers
+    std::vector<NestedValue> _nested;
 };
 
 class RowWriter {
   public:
     RowWriter(Writer &writer);
+    // a copy would finish the row twice
+    RowWriter(RowWriter const &) = delete;
+    RowWriter &operator=(RowWriter const &) = delete;
+    // finishes the row and flushes the writer
     ~RowWriter();
 
     void write_null();
@@ -42,11 +93,51 @@ class RowWriter {
     void write_int8(int64_t v);
     void write_float4(float v);
     void write_float8(double v);
+    // temporal values use DuckDB's representation, i.e. the unix epoch
+    void write_date(int32_t days);
+    void write_time(int64_t micros);
+    void write_timestamp(int64_t micros);
+    void write_timestamptz(int64_t micros);
+    void write_interval(int32_t months, int32_t days, int64_t micros);
+    // numeric of v / 10^scale
+    void write_decimal(Int128 v, uint8_t scale);
+    // the 16 bytes of the uuid in network order
+    void write_uuid(Byte const *bytes);
+    void write_bytea(Byte const *data, std::size_t size);
+
+    // arrays and records are written between begin_* and end_*, their
+    // elements with the write_* functions above, in the column's format
+    void begin_array(Oid element_oid);
+    void end_array();
+    void begin_record();
+    // binary records carry the oid of every field, call before each one
+    void record_field(Oid oid);
+    void end_record();
+
+    // format of the column that is written next
+    FormatCode format_code() const;
+
+    // the data encoded so far, ending with the values of this row, a value
+    // can be copied out and repeated in other rows of the same column with
+    // write_encoded
+    Bytes const &encoded() const;
+    void write_encoded(Byte const *b, std::size_t size);
+
+  private:
+    template <typename T> void write_number(T v);
+    void begin_nested(NestedKind kind, Oid element_oid);
+    void end_nested();
+    // buffer of the current column or of the innermost nested value
+    Buffer &output();
+    // moves to the next column or element
+    void advance();
 
   private:
     Writer &_writer;
-    Buffer _row;
+    // offset of the DataRow in the writer's data
+    std::size_t _start;
     std::size_t _current_col = 0;
+    std::size_t _depth = 0;
 };
 
 } // namespace pgwire
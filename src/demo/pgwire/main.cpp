@@ -17,10 +17,15 @@ int main(int argc, char **argv) {
         len = atoll(argv[1]);
     }
 
+    std::size_t num_threads = 1;
+    if (argc > 2) {
+        num_threads = std::max(atoi(argv[2]), 1);
+    }
+
     pgwire::log::initialize(io_context);
 
     pgwire::Server server(io_context, endpoint, [len](pgwire::Session &sess) {
-        return [len](std::string const &query) {
+        return [len](std::string_view query) {
             pgwire::PreparedStatement stmt;
             stmt.fields = pgwire::Fields{
                 {"name", pgwire::Oid::Text},
@@ -29,7 +34,8 @@ int main(int argc, char **argv) {
             };
             stmt.handler = [len](pgwire::Writer &writer,
                                  pgwire::Values const &parameters) {
-                for (int i = 1; i <= len; i++) {
+                // the rows are streamed while the client keeps up
+                for (int i = 1; i <= len && writer.flush(); i++) {
                     auto row = writer.add_row();
                     row.write_string("euiko");
                     row.write_string("indonesia");
@@ -38,7 +44,7 @@ int main(int argc, char **argv) {
             };
             return stmt;
         };
-    });
+    }, num_threads);
     server.start();
     io_context.run();
     return 0;
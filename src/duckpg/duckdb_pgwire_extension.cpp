@@ -1,8 +1,8 @@
 #include "duckdb/common/types.hpp"
-#include <unordered_map>
 #define DUCKDB_EXTENSION_MAIN
 
 #include <duckpg/duckdb_pgwire_extension.hpp>
+#include <duckpg/handler.hpp>
 
 #include <duckdb/common/exception.hpp>
 #include <duckdb/common/string_util.hpp>
@@ -10,163 +10,25 @@
 #include <duckdb/main/extension_util.hpp>
 #include <duckdb/parser/parsed_data/create_scalar_function_info.hpp>
 
+#include <algorithm>
 #include <atomic>
-#include <optional>
-#include <pgwire/exception.hpp>
+#include <cstdlib>
+#include <cstring>
 #include <pgwire/log.hpp>
 #include <pgwire/server.hpp>
-#include <pgwire/types.hpp>
-#include <stdexcept>
+#include <thread>
 
 namespace duckdb {
 
 static std::atomic<bool> g_started;
 
-static std::unordered_map<LogicalTypeId, pgwire::Oid> g_typemap = {
-    {LogicalTypeId::FLOAT, pgwire::Oid::Float4},
-    {LogicalTypeId::DOUBLE, pgwire::Oid::Float8},
-    // {LogicalTypeId::TINYINT, pgwire::Oid::Char},
-    {LogicalTypeId::SMALLINT, pgwire::Oid::Int2},
-    {LogicalTypeId::INTEGER, pgwire::Oid::Int4},
-    {LogicalTypeId::BIGINT, pgwire::Oid::Int8},
-    // uses string
-    {LogicalTypeId::VARCHAR, pgwire::Oid::Varchar},
-    {LogicalTypeId::DATE, pgwire::Oid::Date},
-    {LogicalTypeId::TIME, pgwire::Oid::Time},
-    {LogicalTypeId::TIMESTAMP, pgwire::Oid::Timestamp},
-    {LogicalTypeId::TIMESTAMP, pgwire::Oid::TimestampTz},
-};
-
-static pgwire::ParseHandler duckdb_handler(DatabaseInstance &db) {
-    return [&db](std::string const &query) mutable {
-        Connection conn(db);
-        pgwire::PreparedStatement stmt;
-        std::unique_ptr<PreparedStatement> prepared;
-        std::optional<pgwire::SqlException> error;
-
-        std::vector<std::string> column_names;
-        std::vector<LogicalType> column_types;
-        std::size_t column_total;
-
-        try {
-            prepared = conn.Prepare(query);
-            if (!prepared) {
-                throw std::runtime_error(
-                    "failed prepare query with unknown error");
-            }
-
-            if (prepared->HasError()) {
-                throw std::runtime_error(prepared->GetError());
-            }
-
-            column_names = prepared->GetNames();
-            column_types = prepared->GetTypes();
-            column_total = prepared->ColumnCount();
-        } catch (std::exception &e) {
-            error =
-                pgwire::SqlException{e.what(), pgwire::SqlState::DataException};
-        }
-
-        // rethrow error
-        if (error) {
-            throw *error;
-        }
-
-        stmt.fields.reserve(column_total);
-        for (std::size_t i = 0; i < column_total; i++) {
-            auto &name = column_names[i];
-            auto &type = column_types[i];
-
-            auto it = g_typemap.find(type.id());
-            if (it == g_typemap.end()) {
-                continue;
-            }
-            auto oid = it->second;
-
-            // can't uses emplace_back for POD struct in C++17
-            stmt.fields.push_back({name, oid});
-        }
-
-        stmt.handler = [column_total, p = std::move(prepared)](
-                           pgwire::Writer &writer,
-                           pgwire::Values const &parameters) mutable {
-            std::unique_ptr<QueryResult> result;
-            std::optional<pgwire::SqlException> error;
-
-            try {
-                result = p->Execute();
-                if (!result) {
-                    throw std::runtime_error(
-                        "failed to execute query with unknown error");
-                }
-
-                if (result->HasError()) {
-                    throw std::runtime_error(result->GetError());
-                }
-
-            } catch (std::exception &e) {
-                // std::cout << "error occured during execute:" << std::endl;
-                error = pgwire::SqlException{e.what(),
-                                             pgwire::SqlState::DataException};
-            }
-
-            if (error) {
-                throw *error;
-            }
-
-            auto &column_types = p->GetTypes();
-
-            for (auto &chunk : *result) {
-                auto row = writer.add_row();
-
-                for (std::size_t i = 0; i < column_total; i++) {
-                    auto &type = column_types[i];
-
-                    auto it = g_typemap.find(type.id());
-                    if (it == g_typemap.end()) {
-                        continue;
-                    }
-
-                    auto value = chunk.iterator.chunk->GetValue(i, chunk.row);
-                    if (value.IsNull()) {
-                        row.write_null();
-                        continue;
-                    }
-
-                    switch (type.id()) {
-                    case LogicalTypeId::FLOAT:
-                        row.write_float4(chunk.GetValue<float>(i));
-                        break;
-                    case LogicalTypeId::DOUBLE:
-                        row.write_float8(chunk.GetValue<double>(i));
-                        break;
-                    case LogicalTypeId::SMALLINT:
-                        row.write_int2(chunk.GetValue<int16_t>(i));
-                        break;
-                    case LogicalTypeId::INTEGER:
-                        row.write_int4(chunk.GetValue<int32_t>(i));
-                        break;
-                    case LogicalTypeId::BIGINT:
-                        row.write_int8(chunk.GetValue<int64_t>(i));
-                        break;
-                    case LogicalTypeId::BOOLEAN:
-                        row.write_bool(chunk.GetValue<bool>(i));
-                        break;
-                    case LogicalTypeId::VARCHAR:
-                    case LogicalTypeId::DATE:
-                    case LogicalTypeId::TIME:
-                    case LogicalTypeId::TIMESTAMP:
-                    case LogicalTypeId::TIMESTAMP_TZ:
-                        row.write_string(chunk.GetValue<std::string>(i));
-                        break;
-                    default:
-                        break;
-                    }
-                }
-            }
-        };
-        return stmt;
-    };
+// DUCKPG_EXECUTION_MODE=stepping runs the queries in time slices on the I/O
+// threads instead of the worker pool
+static ExecutionMode execution_mode() {
+    auto mode = std::getenv("DUCKPG_EXECUTION_MODE");
+    return mode && std::strcmp(mode, "stepping") == 0
+               ? ExecutionMode::Stepping
+               : ExecutionMode::Workers;
 }
 
 static void start_server(DatabaseInstance &db) {
@@ -181,10 +43,25 @@ static void start_server(DatabaseInstance &db) {
 
     pgwire::log::initialize(io_context, "duckdb_pgwire.log");
 
+    // DuckDB does the heavy lifting, one I/O thread per core is plenty for
+    // framing and encoding the results
+    std::size_t num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // statements run on a bounded pool of workers, a heavy query holds one
+    // of them while the other sessions keep being served. DuckDB parallelizes
+    // a single query on its own scheduler, so more workers than cores only
+    // adds contention. Stepping only prepares there.
+    auto mode = execution_mode();
+    thread_pool workers(num_threads);
+
     pgwire::Server server(
         io_context, endpoint,
-        [&db](pgwire::Session &sess) mutable { return duckdb_handler(db); });
+        pgwire::AsyncHandler([&db, &workers, mode](pgwire::Session &sess) {
+            return duckdb_handler(db, sess, workers, mode);
+        }),
+        num_threads);
     server.start();
+    workers.join();
 }
 
 inline void PgIsInRecovery(DataChunk &args, ExpressionState &state,
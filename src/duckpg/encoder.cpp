@@ -0,0 +1,443 @@
+#include <duckpg/encoder.hpp>
+
+#include <cstring>
+
+namespace duckdb {
+
+template <typename T>
+static T const &value_at(RecursiveUnifiedVectorFormat const &format,
+                         idx_t index) {
+    return UnifiedVectorFormat::GetData<T>(format.unified)[index];
+}
+
+static pgwire::Int128 to_int128(hugeint_t const &v) {
+    return {v.lower, v.upper};
+}
+
+template <typename T, typename Arg, void (pgwire::RowWriter::*Write)(Arg)>
+static void encode_value(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                         RecursiveUnifiedVectorFormat const &format,
+                         idx_t index) {
+    (row.*Write)(Arg(value_at<T>(format, index)));
+}
+
+static void encode_varchar(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                           RecursiveUnifiedVectorFormat const &format,
+                           idx_t index) {
+    auto &value = value_at<string_t>(format, index);
+    row.write_value(reinterpret_cast<pgwire::Byte const *>(value.GetData()),
+                    value.GetSize());
+}
+
+static void encode_blob(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                        RecursiveUnifiedVectorFormat const &format,
+                        idx_t index) {
+    auto &value = value_at<string_t>(format, index);
+    row.write_bytea(reinterpret_cast<pgwire::Byte const *>(value.GetData()),
+                    value.GetSize());
+}
+
+static void encode_date(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                        RecursiveUnifiedVectorFormat const &format,
+                        idx_t index) {
+    row.write_date(value_at<date_t>(format, index).days);
+}
+
+static void encode_time(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                        RecursiveUnifiedVectorFormat const &format,
+                        idx_t index) {
+    row.write_time(value_at<dtime_t>(format, index).micros);
+}
+
+static void encode_timestamp(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                             RecursiveUnifiedVectorFormat const &format,
+                             idx_t index) {
+    row.write_timestamp(value_at<timestamp_t>(format, index).value);
+}
+
+static void encode_timestamptz(pgwire::RowWriter &row,
+                               TypeEncoder const &encoder,
+                               RecursiveUnifiedVectorFormat const &format,
+                               idx_t index) {
+    row.write_timestamptz(value_at<timestamp_t>(format, index).value);
+}
+
+static void encode_interval(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                            RecursiveUnifiedVectorFormat const &format,
+                            idx_t index) {
+    auto &value = value_at<interval_t>(format, index);
+    row.write_interval(value.months, value.days, value.micros);
+}
+
+// integers that don't fit into a postgres integer type are sent as numeric
+static void encode_ubigint(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                           RecursiveUnifiedVectorFormat const &format,
+                           idx_t index) {
+    row.write_decimal({value_at<uint64_t>(format, index), 0}, 0);
+}
+
+static void encode_hugeint(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                           RecursiveUnifiedVectorFormat const &format,
+                           idx_t index) {
+    row.write_decimal(to_int128(value_at<hugeint_t>(format, index)), 0);
+}
+
+// DECIMAL is stored as the unscaled value in the smallest integer that
+// holds its width
+template <typename T>
+static void encode_decimal(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                           RecursiveUnifiedVectorFormat const &format,
+                           idx_t index) {
+    auto scale = DecimalType::GetScale(encoder.type);
+    if constexpr (std::is_same_v<T, hugeint_t>) {
+        row.write_decimal(to_int128(value_at<T>(format, index)), scale);
+    } else {
+        int64_t v = value_at<T>(format, index);
+        row.write_decimal({uint64_t(v), v < 0 ? -1 : 0}, scale);
+    }
+}
+
+// DuckDB stores uuids as hugeint with the top bit flipped, so they sort
+// like their text
+static void encode_uuid(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                        RecursiveUnifiedVectorFormat const &format,
+                        idx_t index) {
+    auto &value = value_at<hugeint_t>(format, index);
+    auto upper = uint64_t(value.upper) ^ (uint64_t(1) << 63);
+
+    pgwire::Byte bytes[16];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = pgwire::Byte(upper >> (56 - i * 8));
+        bytes[8 + i] = pgwire::Byte(value.lower >> (56 - i * 8));
+    }
+    row.write_uuid(bytes);
+}
+
+// writes the value at index of a nested vector, or null
+static void encode_child(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                         RecursiveUnifiedVectorFormat const &format,
+                         idx_t row_idx) {
+    auto index = format.unified.sel->get_index(row_idx);
+    if (!format.unified.validity.RowIsValid(index)) {
+        row.write_null();
+        return;
+    }
+    encoder.encode(row, encoder, format, index);
+}
+
+// the values of types without an encoder, a slow path through Value
+static void encode_as_text(pgwire::RowWriter &row, Vector &vector,
+                           idx_t row_idx) {
+    auto value = vector.GetValue(row_idx);
+    if (value.IsNull()) {
+        row.write_null();
+        return;
+    }
+    row.write_string(value.ToString());
+}
+
+// lists are a range of their child vector, the elements are read from there
+static void encode_list(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                        RecursiveUnifiedVectorFormat const &format,
+                        idx_t index) {
+    auto &entry = value_at<list_entry_t>(format, index);
+    auto &element = encoder.children[0];
+    auto &child = format.children[0];
+
+    row.begin_array(element.oid);
+    for (idx_t i = 0; i < entry.length; i++) {
+        encode_child(row, element, child, entry.offset + i);
+    }
+    row.end_array();
+}
+
+static void encode_struct(pgwire::RowWriter &row, TypeEncoder const &encoder,
+                          RecursiveUnifiedVectorFormat const &format,
+                          idx_t index) {
+    row.begin_record();
+    for (std::size_t i = 0; i < encoder.children.size(); i++) {
+        auto &field = encoder.children[i];
+        row.record_field(field.oid);
+        encode_child(row, field, format.children[i], index);
+    }
+    row.end_record();
+}
+
+// arrays of the element types that have one
+static pgwire::Oid array_oid(pgwire::Oid element) {
+    using Oid = pgwire::Oid;
+
+    switch (element) {
+    case Oid::Bool:
+        return Oid::BoolArray;
+    case Oid::Int2:
+        return Oid::Int2Array;
+    case Oid::Int4:
+        return Oid::Int4Array;
+    case Oid::Int8:
+        return Oid::Int8Array;
+    case Oid::Float4:
+        return Oid::Float4Array;
+    case Oid::Float8:
+        return Oid::Float8Array;
+    case Oid::Numeric:
+        return Oid::NumericArray;
+    case Oid::Varchar:
+        return Oid::VarcharArray;
+    case Oid::Bytea:
+        return Oid::ByteaArray;
+    case Oid::Uuid:
+        return Oid::UuidArray;
+    case Oid::Date:
+        return Oid::DateArray;
+    case Oid::Time:
+        return Oid::TimeArray;
+    case Oid::Timestamp:
+        return Oid::TimestampArray;
+    case Oid::TimestampTz:
+        return Oid::TimestampTzArray;
+    case Oid::Interval:
+        return Oid::IntervalArray;
+    case Oid::Record:
+        return Oid::RecordArray;
+    default:
+        return Oid::Unknown;
+    }
+}
+
+static ValueEncoder resolve_decimal(LogicalType const &type) {
+    switch (type.InternalType()) {
+    case PhysicalType::INT16:
+        return encode_decimal<int16_t>;
+    case PhysicalType::INT32:
+        return encode_decimal<int32_t>;
+    case PhysicalType::INT64:
+        return encode_decimal<int64_t>;
+    case PhysicalType::INT128:
+        return encode_decimal<hugeint_t>;
+    default:
+        return nullptr;
+    }
+}
+
+// fills the encoder of type, returns false when it can't be encoded
+static bool resolve(LogicalType const &type, TypeEncoder &encoder) {
+    using Oid = pgwire::Oid;
+    using RowWriter = pgwire::RowWriter;
+
+    encoder.type = type;
+    switch (type.id()) {
+    case LogicalTypeId::BOOLEAN:
+        encoder.oid = Oid::Bool;
+        encoder.encode = encode_value<bool, bool, &RowWriter::write_bool>;
+        break;
+    // postgres has no 1 byte integer and no unsigned types, they are
+    // widened to the next signed type
+    case LogicalTypeId::TINYINT:
+        encoder.oid = Oid::Int2;
+        encoder.encode = encode_value<int8_t, int16_t, &RowWriter::write_int2>;
+        break;
+    case LogicalTypeId::UTINYINT:
+        encoder.oid = Oid::Int2;
+        encoder.encode = encode_value<uint8_t, int16_t, &RowWriter::write_int2>;
+        break;
+    case LogicalTypeId::SMALLINT:
+        encoder.oid = Oid::Int2;
+        encoder.encode = encode_value<int16_t, int16_t, &RowWriter::write_int2>;
+        break;
+    case LogicalTypeId::USMALLINT:
+        encoder.oid = Oid::Int4;
+        encoder.encode =
+            encode_value<uint16_t, int32_t, &RowWriter::write_int4>;
+        break;
+    case LogicalTypeId::INTEGER:
+        encoder.oid = Oid::Int4;
+        encoder.encode = encode_value<int32_t, int32_t, &RowWriter::write_int4>;
+        break;
+    case LogicalTypeId::UINTEGER:
+        encoder.oid = Oid::Int8;
+        encoder.encode =
+            encode_value<uint32_t, int64_t, &RowWriter::write_int8>;
+        break;
+    case LogicalTypeId::BIGINT:
+        encoder.oid = Oid::Int8;
+        encoder.encode = encode_value<int64_t, int64_t, &RowWriter::write_int8>;
+        break;
+    case LogicalTypeId::UBIGINT:
+        encoder.oid = Oid::Numeric;
+        encoder.encode = encode_ubigint;
+        break;
+    case LogicalTypeId::HUGEINT:
+        encoder.oid = Oid::Numeric;
+        encoder.encode = encode_hugeint;
+        break;
+    case LogicalTypeId::DECIMAL:
+        encoder.oid = Oid::Numeric;
+        encoder.encode = resolve_decimal(type);
+        break;
+    case LogicalTypeId::FLOAT:
+        encoder.oid = Oid::Float4;
+        encoder.encode = encode_value<float, float, &RowWriter::write_float4>;
+        break;
+    case LogicalTypeId::DOUBLE:
+        encoder.oid = Oid::Float8;
+        encoder.encode = encode_value<double, double, &RowWriter::write_float8>;
+        break;
+    case LogicalTypeId::VARCHAR:
+        encoder.oid = Oid::Varchar;
+        encoder.encode = encode_varchar;
+        break;
+    case LogicalTypeId::BLOB:
+        encoder.oid = Oid::Bytea;
+        encoder.encode = encode_blob;
+        break;
+    case LogicalTypeId::UUID:
+        encoder.oid = Oid::Uuid;
+        encoder.encode = encode_uuid;
+        break;
+    case LogicalTypeId::DATE:
+        encoder.oid = Oid::Date;
+        encoder.encode = encode_date;
+        break;
+    case LogicalTypeId::TIME:
+        encoder.oid = Oid::Time;
+        encoder.encode = encode_time;
+        break;
+    case LogicalTypeId::TIMESTAMP:
+        encoder.oid = Oid::Timestamp;
+        encoder.encode = encode_timestamp;
+        break;
+    case LogicalTypeId::TIMESTAMP_TZ:
+        encoder.oid = Oid::TimestampTz;
+        encoder.encode = encode_timestamptz;
+        break;
+    case LogicalTypeId::INTERVAL:
+        encoder.oid = Oid::Interval;
+        encoder.encode = encode_interval;
+        break;
+    case LogicalTypeId::LIST: {
+        // postgres arrays are rectangular, lists of lists are sent as text
+        encoder.children.resize(1);
+        auto &element = encoder.children[0];
+        if (!resolve(ListType::GetChildType(type), element)) {
+            return false;
+        }
+        encoder.oid = array_oid(element.oid);
+        encoder.encode = encode_list;
+        break;
+    }
+    case LogicalTypeId::STRUCT: {
+        auto &fields = StructType::GetChildTypes(type);
+        encoder.children.resize(fields.size());
+        for (std::size_t i = 0; i < fields.size(); i++) {
+            if (!resolve(fields[i].second, encoder.children[i])) {
+                return false;
+            }
+        }
+        encoder.oid = Oid::Record;
+        encoder.encode = encode_struct;
+        break;
+    }
+    default:
+        return false;
+    }
+
+    return encoder.encode != nullptr && encoder.oid != Oid::Unknown;
+}
+
+pgwire::Oid type_oid(LogicalType const &type) {
+    TypeEncoder encoder;
+    return resolve(type, encoder) ? encoder.oid : pgwire::Oid::Unknown;
+}
+
+pgwire::Oid ResultEncoder::add_column(idx_t index, LogicalType const &type) {
+    Column column;
+    column.index = index;
+    column.as_text = !resolve(type, column.encoder);
+    auto oid = column.as_text ? pgwire::Oid::Text : column.encoder.oid;
+
+    _columns.push_back(std::move(column));
+    return oid;
+}
+
+std::size_t ResultEncoder::num_columns() const { return _columns.size(); }
+
+void ResultEncoder::prepare_cells(Column &column, Vector &vector,
+                                  idx_t count) {
+    column.repeats = false;
+    column.cells.clear();
+
+    auto vector_type = vector.GetVectorType();
+    if (vector_type != VectorType::CONSTANT_VECTOR &&
+        vector_type != VectorType::DICTIONARY_VECTOR) {
+        return;
+    }
+
+    // a dictionary only repeats values when it has fewer entries than the
+    // chunk has rows, filters produce dictionaries too but of distinct rows
+    idx_t num_values = 0;
+    auto &sel = *column.format.unified.sel;
+    for (idx_t i = 0; i < count; i++) {
+        num_values = std::max(num_values, idx_t(sel.get_index(i)) + 1);
+    }
+    if (vector_type == VectorType::DICTIONARY_VECTOR && num_values >= count) {
+        return;
+    }
+
+    column.repeats = true;
+    column.cell_index.assign(num_values, Cell{0, 0});
+}
+
+void ResultEncoder::encode_cell(pgwire::RowWriter &row, Column &column,
+                                idx_t row_idx) {
+    auto index = column.format.unified.sel->get_index(row_idx);
+    auto &cell = column.cell_index[index];
+    if (cell.size > 0) {
+        row.write_encoded(column.cells.data() + cell.offset, cell.size);
+        return;
+    }
+
+    // first time the value shows up in the chunk, it is never empty since
+    // the length comes first
+    auto begin = row.encoded().size();
+    encode_child(row, column.encoder, column.format, row_idx);
+
+    auto &encoded = row.encoded();
+    cell.offset = uint32_t(column.cells.size());
+    cell.size = uint32_t(encoded.size() - begin);
+    column.cells.resize(cell.offset + cell.size);
+    std::memcpy(column.cells.data() + cell.offset, encoded.data() + begin,
+                cell.size);
+}
+
+bool ResultEncoder::encode(DataChunk &chunk, pgwire::Writer &writer) {
+    auto count = chunk.size();
+    for (auto &column : _columns) {
+        if (column.as_text) {
+            continue;
+        }
+        auto &vector = chunk.data[column.index];
+        Vector::RecursiveToUnifiedFormat(vector, count, column.format);
+        prepare_cells(column, vector, count);
+    }
+
+    for (idx_t row_idx = 0; row_idx < count; row_idx++) {
+        if (!writer.flush()) {
+            return false;
+        }
+        auto row = writer.add_row();
+
+        for (auto &column : _columns) {
+            if (column.as_text) {
+                encode_as_text(row, chunk.data[column.index], row_idx);
+            } else if (column.repeats) {
+                encode_cell(row, column, row_idx);
+            } else {
+                encode_child(row, column.encoder, column.format, row_idx);
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace duckdb
@@ -0,0 +1,631 @@
+#include <duckpg/encoder.hpp>
+#include <duckpg/handler.hpp>
+
+#include <duckdb/main/client_context.hpp>
+#include <duckdb/main/pending_query_result.hpp>
+#include <duckdb/main/valid_checker.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <limits>
+#include <optional>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <strings.h>
+
+#include <pgwire/exception.hpp>
+
+namespace duckdb {
+
+// reflects the connection's transaction in the session's ReadyForQuery.
+// DuckDB keeps a transaction usable after most errors, it only fails once
+// DuckDB invalidated it and stays failed until it is rolled back.
+static void update_transaction_status(pgwire::Session &session,
+                                      Connection &conn) {
+    using Status = pgwire::ReadyForQuery::Status;
+
+    auto &context = *conn.context;
+    if (conn.IsAutoCommit() || !context.transaction.HasActiveTransaction()) {
+        session.set_transaction_status(Status::Idle);
+    } else if (ValidChecker::IsInvalidated(context.ActiveTransaction())) {
+        session.set_transaction_status(Status::Failed);
+    } else {
+        session.set_transaction_status(Status::Block);
+    }
+}
+
+// Statement is what a prepared statement runs with, it is shared with the
+// running query since the client may close the statement meanwhile
+struct Statement {
+    std::unique_ptr<PreparedStatement> prepared;
+    ResultEncoder encoder;
+    StatementReturnType return_type = StatementReturnType::QUERY_RESULT;
+};
+
+// encodes a chunk of the result, only queries send their rows. The result of
+// a statement changing rows is their count, the other statements have
+// nothing to send.
+static void encode(Statement &statement, DataChunk &chunk,
+                   pgwire::Writer &writer) {
+    switch (statement.return_type) {
+    case StatementReturnType::QUERY_RESULT:
+        statement.encoder.encode(chunk, writer);
+        break;
+    case StatementReturnType::CHANGED_ROWS:
+        writer.set_rows_affected(chunk.GetValue(0, 0).GetValue<int64_t>());
+        break;
+    default:
+        break;
+    }
+}
+
+// parameters arrive as text, DuckDB casts them to the types expected by the
+// statement
+static vector<Value> to_values(pgwire::Values const &parameters) {
+    vector<Value> values;
+    values.reserve(parameters.size());
+    for (auto &param : parameters) {
+        values.push_back(param ? Value(*param) : Value());
+    }
+    return values;
+}
+
+// DuckDB clears the interrupt of a connection when a query begins, so a
+// cancel that came before the pending query was set up is repeated once the
+// query is running
+static void interrupt_if_cancelled(Connection &conn,
+                                   pgwire::AsyncResult &result) {
+    if (result.interrupted()) {
+        conn.Interrupt();
+    }
+}
+
+// FetchedQuery streams a query result from the workers. A task fetches and
+// encodes chunks until the client falls behind, then returns its worker and
+// the next task is posted once the queued rows are written, so slow clients
+// don't hold the pool.
+class FetchedQuery : public std::enable_shared_from_this<FetchedQuery> {
+  public:
+    FetchedQuery(std::shared_ptr<Statement> statement,
+                 std::shared_ptr<Connection> conn, pgwire::Session &session,
+                 pgwire::AsyncResultPtr result,
+                 unique_ptr<QueryResult> query_result,
+                 asio::thread_pool &workers);
+
+    void fetch();
+
+  private:
+    std::shared_ptr<Statement> _statement;
+    std::shared_ptr<Connection> _conn;
+    pgwire::Session &_session;
+    pgwire::AsyncResultPtr _result;
+    unique_ptr<QueryResult> _query_result;
+    asio::thread_pool &_workers;
+};
+
+FetchedQuery::FetchedQuery(std::shared_ptr<Statement> statement,
+                           std::shared_ptr<Connection> conn,
+                           pgwire::Session &session,
+                           pgwire::AsyncResultPtr result,
+                           unique_ptr<QueryResult> query_result,
+                           asio::thread_pool &workers)
+    : _statement(std::move(statement)), _conn(std::move(conn)),
+      _session(session), _result(std::move(result)),
+      _query_result(std::move(query_result)), _workers(workers) {}
+
+void FetchedQuery::fetch() {
+    try {
+        // stop fetching once the client is gone
+        while (!_result->cancelled()) {
+            if (!_result->writable()) {
+                _result->on_writable([self = shared_from_this()] {
+                    asio::post(self->_workers, [self] { self->fetch(); });
+                });
+                return;
+            }
+
+            auto chunk = _query_result->Fetch();
+            if (!chunk || chunk->size() == 0) {
+                break;
+            }
+            encode(*_statement, *chunk, _result->writer());
+        }
+
+        if (_query_result->HasError()) {
+            throw std::runtime_error(_query_result->GetError());
+        }
+    } catch (std::exception &e) {
+        update_transaction_status(_session, *_conn);
+        _result->fail(
+            pgwire::SqlException{e.what(), pgwire::SqlState::DataException});
+        return;
+    }
+    _result->finish();
+}
+
+// runs on a worker, the session waits for the statement so its transaction
+// status may be updated from there
+static void execute(std::shared_ptr<Statement> statement,
+                    std::shared_ptr<Connection> conn,
+                    pgwire::Session &session, pgwire::AsyncResultPtr result,
+                    pgwire::Values const &parameters,
+                    asio::thread_pool &workers) {
+    unique_ptr<QueryResult> query_result;
+    std::optional<pgwire::SqlException> error;
+
+    auto values = to_values(parameters);
+    try {
+        auto pending = statement->prepared->PendingQuery(values, true);
+        if (!pending || pending->HasError()) {
+            throw std::runtime_error(
+                pending ? pending->GetError()
+                        : "failed to execute query with unknown error");
+        }
+        interrupt_if_cancelled(*conn, *result);
+
+        query_result = pending->Execute();
+        if (!query_result) {
+            throw std::runtime_error(
+                "failed to execute query with unknown error");
+        }
+
+        if (query_result->HasError()) {
+            throw std::runtime_error(query_result->GetError());
+        }
+
+    } catch (std::exception &e) {
+        error =
+            pgwire::SqlException{e.what(), pgwire::SqlState::DataException};
+    }
+
+    update_transaction_status(session, *conn);
+    if (error) {
+        result->fail(std::move(*error));
+        return;
+    }
+
+    auto query = std::make_shared<FetchedQuery>(
+        std::move(statement), std::move(conn), session, std::move(result),
+        std::move(query_result), workers);
+    query->fetch();
+}
+
+// skips the whitespace and comments in front of the next keyword of query
+// and returns it in upper case, or nothing at the end of query
+static std::string next_keyword(std::string_view query, std::size_t &pos) {
+    auto is_letter = [&query](std::size_t i) {
+        return std::isalpha(static_cast<unsigned char>(query[i])) != 0;
+    };
+    while (pos < query.size() && !is_letter(pos)) {
+        if (query.compare(pos, 2, "--") == 0) {
+            pos = std::min(query.find('\n', pos), query.size());
+        } else if (query.compare(pos, 2, "/*") == 0) {
+            pos = std::min(query.find("*/", pos + 2), query.size() - 2) + 2;
+        } else {
+            pos++;
+        }
+    }
+
+    std::string keyword;
+    for (; pos < query.size() && is_letter(pos); pos++) {
+        keyword.push_back(char(std::toupper(query[pos])));
+    }
+    return keyword;
+}
+
+// the command of the CommandComplete tag. DuckDB only knows the kind of a
+// statement, so the command of the statements that don't count rows is
+// taken from their leading keywords, e.g. BEGIN or CREATE TABLE.
+static std::string command_of(PreparedStatement &prepared,
+                              std::string_view query) {
+    switch (prepared.GetStatementType()) {
+    case StatementType::SELECT_STATEMENT:
+        return "SELECT";
+    case StatementType::INSERT_STATEMENT:
+        return "INSERT";
+    case StatementType::UPDATE_STATEMENT:
+        return "UPDATE";
+    case StatementType::DELETE_STATEMENT:
+        return "DELETE";
+    case StatementType::COPY_STATEMENT:
+        return "COPY";
+    default:
+        break;
+    }
+
+    std::size_t pos = 0;
+    auto command = next_keyword(query, pos);
+    if (command == "CREATE" || command == "DROP" || command == "ALTER") {
+        // the kind of object follows the modifiers
+        auto object = next_keyword(query, pos);
+        while (object == "OR" || object == "REPLACE" || object == "TEMP" ||
+               object == "TEMPORARY" || object == "PERSISTENT" ||
+               object == "UNIQUE") {
+            object = next_keyword(query, pos);
+        }
+        if (!object.empty()) {
+            command += ' ' + object;
+        }
+    }
+    // an empty command would be taken for the empty query
+    return command.empty() ? "OK" : command;
+}
+
+// prepares query into statement, the returned statement has no handler yet
+static pgwire::PreparedStatement prepare(Statement &statement,
+                                         Connection &conn,
+                                         pgwire::Session &session,
+                                         std::string const &query) {
+    pgwire::PreparedStatement stmt;
+    std::optional<pgwire::SqlException> error;
+
+    std::vector<std::string> column_names;
+    std::vector<LogicalType> column_types;
+    std::size_t column_total;
+
+    try {
+        statement.prepared = conn.Prepare(query);
+        auto &prepared = statement.prepared;
+        if (!prepared) {
+            throw std::runtime_error("failed prepare query with unknown error");
+        }
+
+        if (prepared->HasError()) {
+            throw std::runtime_error(prepared->GetError());
+        }
+
+        column_names = prepared->GetNames();
+        column_types = prepared->GetTypes();
+        column_total = prepared->ColumnCount();
+        statement.return_type = prepared->GetStatementProperties().return_type;
+        stmt.command = command_of(*prepared, query);
+    } catch (std::exception &e) {
+        error = pgwire::SqlException{e.what(), pgwire::SqlState::DataException};
+    }
+
+    // rethrow error
+    if (error) {
+        update_transaction_status(session, conn);
+        throw *error;
+    }
+
+    // only queries have columns, the other statements send no rows
+    if (statement.return_type != StatementReturnType::QUERY_RESULT) {
+        column_total = 0;
+    }
+
+    // every column is sent, the encoder decides the oid it is sent as
+    auto &encoder = statement.encoder;
+    stmt.fields.reserve(column_total);
+    for (std::size_t i = 0; i < column_total; i++) {
+        auto &name = column_names[i];
+        auto oid = encoder.add_column(i, column_types[i]);
+
+        // can't uses emplace_back for POD struct in C++17
+        stmt.fields.push_back({name, oid});
+    }
+
+    // parameters are keyed by their 1-based position
+    auto &prepared = statement.prepared;
+    auto parameter_types = prepared->GetExpectedParameterTypes();
+    stmt.parameter_types.reserve(prepared->n_param);
+    for (idx_t i = 1; i <= prepared->n_param; i++) {
+        auto oid = pgwire::Oid::Unknown;
+        auto param_it = parameter_types.find(std::to_string(i));
+        // nested values are left to the client, DuckDB doesn't read the
+        // postgres array and record text
+        if (param_it != parameter_types.end() &&
+            !param_it->second.IsNested()) {
+            oid = type_oid(param_it->second);
+        }
+        stmt.parameter_types.push_back(oid);
+    }
+
+    return stmt;
+}
+
+// SteppedQuery runs a pending query in time slices on the session's I/O
+// thread. Every slice executes DuckDB tasks until kSlice is spent and then
+// posts the next slice, so the other sessions of the thread are served in
+// between. Once the result is ready it is fetched on the workers, a fetch of
+// a streaming result runs the last pipeline of the query until it has a
+// chunk and can't be split into slices.
+class SteppedQuery : public std::enable_shared_from_this<SteppedQuery> {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr auto kSlice = std::chrono::microseconds(500);
+    // wait before the next slice when DuckDB has no task for this thread,
+    // i.e. its own threads run the remaining ones or the query is blocked.
+    // DuckDB doesn't signal when that changes, so it is polled, backing off
+    // up to kMaxPollInterval while the query makes no progress.
+    static constexpr auto kMinPollInterval = std::chrono::microseconds(100);
+    static constexpr auto kMaxPollInterval = std::chrono::microseconds(10000);
+
+    SteppedQuery(std::shared_ptr<Statement> statement,
+                 std::shared_ptr<Connection> conn, pgwire::Session &session,
+                 pgwire::AsyncResultPtr result,
+                 unique_ptr<PendingQueryResult> pending,
+                 asio::thread_pool &workers);
+
+    void step();
+
+  private:
+    void yield();
+    void poll();
+    void fail(std::string const &message);
+
+    std::shared_ptr<Statement> _statement;
+    std::shared_ptr<Connection> _conn;
+    pgwire::Session &_session;
+    pgwire::AsyncResultPtr _result;
+    unique_ptr<PendingQueryResult> _pending;
+    asio::thread_pool &_workers;
+    asio::steady_timer _timer;
+    std::chrono::microseconds _poll_interval = kMinPollInterval;
+};
+
+SteppedQuery::SteppedQuery(std::shared_ptr<Statement> statement,
+                           std::shared_ptr<Connection> conn,
+                           pgwire::Session &session,
+                           pgwire::AsyncResultPtr result,
+                           unique_ptr<PendingQueryResult> pending,
+                           asio::thread_pool &workers)
+    : _statement(std::move(statement)), _conn(std::move(conn)),
+      _session(session), _result(std::move(result)),
+      _pending(std::move(pending)), _workers(workers),
+      _timer(session.executor()) {}
+
+void SteppedQuery::step() {
+    auto deadline = Clock::now() + kSlice;
+
+    unique_ptr<QueryResult> query_result;
+    try {
+        while (!query_result) {
+            if (_result->cancelled()) {
+                _result->finish();
+                return;
+            }
+
+            switch (_pending->ExecuteTask()) {
+            case PendingExecutionResult::RESULT_READY:
+                query_result = _pending->Execute();
+                if (!query_result || query_result->HasError()) {
+                    throw std::runtime_error(
+                        query_result ? query_result->GetError()
+                                     : "failed to execute query");
+                }
+                update_transaction_status(_session, *_conn);
+                break;
+            case PendingExecutionResult::EXECUTION_ERROR:
+                throw std::runtime_error(_pending->GetError());
+            case PendingExecutionResult::RESULT_NOT_READY:
+                _poll_interval = kMinPollInterval;
+                break;
+            default:
+                // blocked or the remaining tasks run on DuckDB's threads
+                poll();
+                return;
+            }
+
+            if (!query_result && Clock::now() >= deadline) {
+                yield();
+                return;
+            }
+        }
+    } catch (std::exception &e) {
+        fail(e.what());
+        return;
+    }
+
+    auto query = std::make_shared<FetchedQuery>(
+        std::move(_statement), std::move(_conn), _session, std::move(_result),
+        std::move(query_result), _workers);
+    asio::post(_workers, [query] { query->fetch(); });
+}
+
+void SteppedQuery::yield() {
+    asio::post(_session.executor(),
+               [self = shared_from_this()] { self->step(); });
+}
+
+void SteppedQuery::poll() {
+    _timer.expires_after(_poll_interval);
+    _poll_interval = std::min(_poll_interval * 2, kMaxPollInterval);
+    _timer.async_wait(
+        [self = shared_from_this()](asio::error_code) { self->step(); });
+}
+
+void SteppedQuery::fail(std::string const &message) {
+    update_transaction_status(_session, *_conn);
+    _result->fail(
+        pgwire::SqlException{message, pgwire::SqlState::DataException});
+}
+
+// runs on a worker, binds the parameters and sets the pending query up, its
+// tasks are then stepped on the session's I/O thread
+static void execute_stepped(std::shared_ptr<Statement> statement,
+                            std::shared_ptr<Connection> conn,
+                            pgwire::Session &session,
+                            pgwire::AsyncResultPtr result,
+                            pgwire::Values const &parameters,
+                            asio::thread_pool &workers) {
+    auto values = to_values(parameters);
+    auto pending = statement->prepared->PendingQuery(values, true);
+    if (!pending || pending->HasError()) {
+        update_transaction_status(session, *conn);
+        result->fail(pgwire::SqlException{
+            pending ? pending->GetError()
+                    : "failed to execute query with unknown error",
+            pgwire::SqlState::DataException});
+        return;
+    }
+
+    interrupt_if_cancelled(*conn, *result);
+
+    auto query = std::make_shared<SteppedQuery>(
+        std::move(statement), std::move(conn), session, std::move(result),
+        std::move(pending), workers);
+    asio::post(session.executor(), [query] { query->step(); });
+}
+
+std::optional<std::chrono::milliseconds>
+statement_timeout(std::string_view query) {
+    // a look at the first keyword keeps the other queries off the regex
+    auto start = std::min(query.find_first_not_of(" \t\r\n"), query.size());
+    auto rest = query.substr(start);
+    auto starts_with = [rest](std::string_view keyword) {
+        return rest.size() >= keyword.size() &&
+               strncasecmp(rest.data(), keyword.data(), keyword.size()) == 0;
+    };
+    if (!starts_with("set") && !starts_with("reset")) {
+        return std::nullopt;
+    }
+
+    static std::regex const kPattern{
+        R"(^\s*(?:set\s+(?:session\s+)?statement_timeout\s*(?:=|to)\s*)"
+        R"((.*?)|reset\s+statement_timeout)\s*;?\s*$)",
+        std::regex::icase};
+
+    std::match_results<std::string_view::const_iterator> match;
+    if (!std::regex_match(query.begin(), query.end(), match, kPattern)) {
+        return std::nullopt;
+    }
+
+    auto equals = [](std::string_view s, std::string_view name) {
+        return s.size() == name.size() &&
+               strncasecmp(s.data(), name.data(), name.size()) == 0;
+    };
+    auto value = query.substr(match.position(1), match.length(1));
+    if (value.size() >= 2 && value.front() == '\'' && value.back() == '\'') {
+        value = value.substr(1, value.size() - 2);
+    }
+    // RESET and DEFAULT disable it
+    if (!match[1].matched || equals(value, "default")) {
+        return std::chrono::milliseconds{0};
+    }
+
+    // plain numbers are milliseconds, the largest timeout is the one
+    // PostgreSQL accepts
+    constexpr int64_t kMax = std::numeric_limits<int32_t>::max();
+    int64_t timeout = 0;
+    auto end = value.data() + value.size();
+    auto [p, ec] = std::from_chars(value.data(), end, timeout);
+    auto unit = std::string_view(p, end - p);
+    unit.remove_prefix(std::min(unit.find_first_not_of(' '), unit.size()));
+    int64_t scale = 0;
+    if (unit.empty() || equals(unit, "ms")) {
+        scale = 1;
+    } else if (equals(unit, "s")) {
+        scale = 1000;
+    } else if (equals(unit, "min")) {
+        scale = 60 * 1000;
+    }
+    if (ec == std::errc::invalid_argument || scale == 0) {
+        throw pgwire::SqlException{"invalid value for parameter "
+                                   "\"statement_timeout\": \"" +
+                                       std::string(value) + "\"",
+                                   pgwire::SqlState::InvalidParameterValue};
+    }
+    if (ec == std::errc::result_out_of_range || timeout < 0 ||
+        timeout > kMax / scale) {
+        throw pgwire::SqlException{
+            std::string(value) +
+                " is outside the valid range for parameter "
+                "\"statement_timeout\" (0 .. " +
+                std::to_string(kMax) + " ms)",
+            pgwire::SqlState::InvalidParameterValue};
+    }
+    return std::chrono::milliseconds{timeout * scale};
+}
+
+// the statement of SET statement_timeout, it runs on the session's thread
+static pgwire::PreparedStatement
+set_statement_timeout(pgwire::Session &session,
+                      std::chrono::milliseconds timeout) {
+    pgwire::PreparedStatement stmt;
+    stmt.command = "SET";
+    stmt.async_handler = [&session, timeout](pgwire::AsyncResultPtr result,
+                                             pgwire::Values const &) {
+        session.set_statement_timeout(timeout);
+        result->finish();
+    };
+    return stmt;
+}
+
+pgwire::AsyncParseHandler duckdb_handler(DatabaseInstance &db,
+                                         pgwire::Session &session,
+                                         asio::thread_pool &workers,
+                                         ExecutionMode mode) {
+    // every session owns a connection, so settings, temporary tables and
+    // transactions outlive a single statement
+    auto conn = std::make_shared<Connection>(db);
+    // cancel requests and the statement timeout interrupt the running query
+    session.set_cancel_handler([conn] { conn->Interrupt(); });
+
+    // prepare runs on the workers in both modes, parsing, binding and
+    // planning a statement may take a while. A session runs one statement at
+    // a time, so its connection is never used by two threads at once.
+    return [conn, &session, &workers,
+            mode](std::string_view query,
+                  pgwire::Completion<pgwire::PreparedStatement> done) {
+        std::optional<std::chrono::milliseconds> timeout;
+        try {
+            timeout = statement_timeout(query);
+        } catch (pgwire::SqlException &e) {
+            done.reject(std::move(e));
+            return;
+        }
+        if (timeout) {
+            done.resolve(set_statement_timeout(session, *timeout));
+            return;
+        }
+
+        asio::post(workers, [conn, &session, &workers, mode,
+                             query = std::string(query),
+                             done = std::move(done)] {
+            auto statement = std::make_shared<Statement>();
+            pgwire::PreparedStatement stmt;
+            try {
+                stmt = prepare(*statement, *conn, session, query);
+            } catch (pgwire::SqlException &e) {
+                done.reject(std::move(e));
+                return;
+            }
+
+            // the parameters are only valid during the call, so they are
+            // copied for the worker
+            if (mode == ExecutionMode::Stepping) {
+                stmt.async_handler = [statement, conn, &session, &workers](
+                                         pgwire::AsyncResultPtr result,
+                                         pgwire::Values const &parameters) {
+                    asio::post(workers, [statement, conn, &session, &workers,
+                                         result = std::move(result),
+                                         parameters = parameters] {
+                        execute_stepped(statement, conn, session, result,
+                                        parameters, workers);
+                    });
+                };
+            } else {
+                // execute and fetch run on the workers too, the I/O thread
+                // only frames the results
+                stmt.async_handler = [statement, conn, &session, &workers](
+                                         pgwire::AsyncResultPtr result,
+                                         pgwire::Values const &parameters) {
+                    asio::post(workers, [statement, conn, &session, &workers,
+                                         result = std::move(result),
+                                         parameters = parameters] {
+                        execute(statement, conn, session, result, parameters,
+                                workers);
+                    });
+                };
+            }
+            done.resolve(std::move(stmt));
+        });
+    };
+}
+
+} // namespace duckdb
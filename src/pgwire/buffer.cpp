@@ -1,15 +1,115 @@
 #include <algorithm>
+#include <cstring>
+
 #include <pgwire/buffer.hpp>
+#include <pgwire/exception.hpp>
 
 namespace pgwire {
 
+static thread_local std::vector<Bytes> tPoolChunks;
+
+[[noreturn]] static void throw_unterminated() {
+    throw SqlException{"string is not null terminated",
+                       SqlState::ProtocolViolation, ErrorSeverity::Fatal};
+}
+
+Bytes BufferPool::acquire(std::size_t capacity) {
+    Bytes bytes;
+    if (!tPoolChunks.empty()) {
+        bytes = std::move(tPoolChunks.back());
+        tPoolChunks.pop_back();
+    }
+    bytes.reserve(capacity);
+    return bytes;
+}
+
+void BufferPool::release(Bytes &&bytes) {
+    if (bytes.capacity() == 0 || bytes.capacity() > kMaxChunkSize ||
+        tPoolChunks.size() >= kMaxChunks) {
+        return;
+    }
+
+    bytes.clear();
+    tPoolChunks.push_back(std::move(bytes));
+}
+
+std::size_t BufferPool::available() { return tPoolChunks.size(); }
+
+double ArenaStats::reuse_rate() const {
+    return acquired == 0 ? 0 : double(reused) / double(acquired);
+}
+
+Bytes BufferArena::acquire(std::size_t capacity) {
+    Bytes bytes;
+    if (!_free.empty()) {
+        bytes = std::move(_free.back());
+        _free.pop_back();
+        _stats.retained_bytes -= bytes.capacity();
+        _stats.reused++;
+    } else {
+        if (BufferPool::available() > 0) {
+            _stats.reused++;
+        }
+        bytes = BufferPool::acquire();
+    }
+    bytes.reserve(capacity);
+
+    _stats.acquired++;
+    _stats.in_use++;
+    _stats.high_water = std::max(_stats.high_water, _stats.in_use);
+    _peak = std::max(_peak, _stats.in_use);
+    return bytes;
+}
+
+void BufferArena::release(Bytes &&bytes) {
+    if (_stats.in_use > 0) {
+        _stats.in_use--;
+    }
+    if (bytes.capacity() == 0 ||
+        bytes.capacity() > BufferPool::kMaxChunkSize ||
+        _free.size() >= BufferPool::kMaxChunks) {
+        return;
+    }
+
+    bytes.clear();
+    _stats.retained_bytes += bytes.capacity();
+    _stats.high_water_bytes =
+        std::max(_stats.high_water_bytes, _stats.retained_bytes);
+    _free.push_back(std::move(bytes));
+}
+
+void BufferArena::reset() {
+    // keep as many chunks as the last query had in use at once, the next one
+    // is likely alike
+    auto keep = _peak > _stats.in_use ? _peak - _stats.in_use : 0;
+    while (_free.size() > keep) {
+        _stats.retained_bytes -= _free.back().capacity();
+        BufferPool::release(std::move(_free.back()));
+        _free.pop_back();
+    }
+
+    _peak = _stats.in_use;
+    _stats.resets++;
+}
+
+ArenaStats const &BufferArena::stats() const { return _stats; }
+
 Buffer::Buffer(Bytes &&data) : _data(std::move(data)) {}
 
+Buffer Buffer::pooled(std::size_t capacity) {
+    return Buffer{BufferPool::acquire(capacity)};
+}
+
 Bytes Buffer::take_bytes() {
     _pos = 0;
     return std::move(_data);
 }
 
+void Buffer::clear() {
+    _data.clear();
+    _pos = 0;
+}
+
 Bytes::const_iterator Buffer::begin() const {
     if (_pos >= _data.size()) {
         return _data.end();
@@ -37,45 +137,83 @@ size_t Buffer::size() const {
 }
 
 std::string Buffer::get_string() {
-    auto it = std::find_if(begin(), end(), [](Byte b) { return b == '\0'; });
-    if (it == end()) {
-        advance(_data.size() - _pos);
-        return "";
+    auto p = buffer();
+    auto n = size();
+    auto found =
+        p ? static_cast<Byte const *>(std::memchr(p, '\0', n)) : nullptr;
+    if (found == nullptr) {
+        throw_unterminated();
     }
 
-    std::string str(begin(), it);
+    std::string str(p, found);
     advance(str.size() + 1);
     return str;
 }
 
-Buffer &Buffer::put_byte(Byte b) {
-    _data.push_back(b);
-    return *this;
+void Buffer::reserve(std::size_t n) {
+    // keep the growth geometric, reserving the exact size on every call
+    // would reallocate on each append
+    if (_data.capacity() - _data.size() < n) {
+        _data.reserve(std::max(_data.size() + n, _data.capacity() * 2));
+    }
+}
+
+void Buffer::truncate(std::size_t n) {
+    if (n < _data.size()) {
+        _data.resize(n);
+    }
 }
 
 Buffer &Buffer::put_bytes(Bytes const &bytes) {
     return put_bytes(bytes.data(), bytes.size());
 }
 
-Buffer &Buffer::put_bytes(Byte const *b, std::size_t size) {
-    _data.reserve(size + _data.size());
-    std::copy(b, b + size, std::back_inserter(_data));
-    // advance(_data.size());
+Buffer &Buffer::put_string(std::string_view const &v, bool append_null_char) {
+    auto p = extend(v.size() + (append_null_char ? 1 : 0));
+    if (!v.empty()) {
+        std::memcpy(p, v.data(), v.size());
+    }
+    if (append_null_char) {
+        p[v.size()] = '\0';
+    }
+
     return *this;
 }
 
-Buffer &Buffer::Buffer::put_string(std::string_view const &v,
-                                   bool append_null_char) {
-    auto p = v.data();
-    _data.reserve(v.size() + _data.size());
-    std::copy(p, p + v.size(), std::back_inserter(_data));
-    // advance(v.size());
+BufferView::BufferView(Byte const *data, size_t size)
+    : _data(data), _size(size) {}
 
-    if (append_null_char) {
-        _data.push_back('\0');
-        // advance(1);
+size_t BufferView::size() const { return _pos >= _size ? 0 : _size - _pos; }
+
+Byte const *BufferView::buffer() const { return _data + _pos; }
+
+void BufferView::advance(size_t n) { _pos += n; }
+
+void BufferView::require(size_t n) const {
+    if (size() < n) {
+        throw SqlException{"message is shorter than expected",
+                           SqlState::ProtocolViolation, ErrorSeverity::Fatal};
     }
+}
 
-    return *this;
+std::string_view BufferView::get_string() {
+    auto p = buffer();
+    auto n = size();
+    auto found = static_cast<Byte const *>(std::memchr(p, '\0', n));
+    if (found == nullptr) {
+        throw_unterminated();
+    }
+
+    std::string_view str(reinterpret_cast<char const *>(p), found - p);
+    advance(str.size() + 1);
+    return str;
 }
-} // namespace pgwire
\ No newline at end of file
+
+std::string_view BufferView::get_bytes(size_t n) {
+    require(n);
+    std::string_view bytes(reinterpret_cast<char const *>(buffer()), n);
+    advance(n);
+    return bytes;
+}
+
+} // namespace pgwire
@@ -0,0 +1,478 @@
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <endian/network.hpp>
+#include <pgwire/format.hpp>
+
+namespace pgwire {
+
+// "00", "01", ..., "99", two digits are written at once
+static constexpr char kDigitPairs[] = "00010203040506070809"
+                                      "10111213141516171819"
+                                      "20212223242526272829"
+                                      "30313233343536373839"
+                                      "40414243444546474849"
+                                      "50515253545556575859"
+                                      "60616263646566676869"
+                                      "70717273747576777879"
+                                      "80818283848586878889"
+                                      "90919293949596979899";
+
+static std::size_t count_digits(uint64_t v) {
+    std::size_t n = 1;
+    for (;;) {
+        if (v < 10)
+            return n;
+        if (v < 100)
+            return n + 1;
+        if (v < 1000)
+            return n + 2;
+        if (v < 10000)
+            return n + 3;
+        v /= 10000;
+        n += 4;
+    }
+}
+
+static std::size_t format_unsigned(char *out, uint64_t v) {
+    auto len = count_digits(v);
+    auto p = out + len;
+    while (v >= 100) {
+        auto pair = (v % 100) * 2;
+        v /= 100;
+        *--p = kDigitPairs[pair + 1];
+        *--p = kDigitPairs[pair];
+    }
+    if (v >= 10) {
+        *--p = kDigitPairs[v * 2 + 1];
+        *--p = kDigitPairs[v * 2];
+    } else {
+        *--p = char('0' + v);
+    }
+    return len;
+}
+
+static std::size_t format_signed(char *out, int64_t v) {
+    if (v >= 0) {
+        return format_unsigned(out, uint64_t(v));
+    }
+    // negate as unsigned, -INT64_MIN doesn't fit in int64_t
+    *out = '-';
+    return 1 + format_unsigned(out + 1, ~uint64_t(v) + 1);
+}
+
+std::size_t format_int2(char *out, int16_t v) { return format_signed(out, v); }
+std::size_t format_int4(char *out, int32_t v) { return format_signed(out, v); }
+std::size_t format_int8(char *out, int64_t v) { return format_signed(out, v); }
+
+static std::size_t copy_literal(char *out, char const *literal) {
+    auto len = std::strlen(literal);
+    std::memcpy(out, literal, len);
+    return len;
+}
+
+// lays out the shortest round-trip digits following postgres' float output,
+// max_exponent is the first decimal exponent written in scientific notation
+template <typename T>
+static std::size_t format_float(char *out, T v, int max_exponent) {
+    if (std::isnan(v)) {
+        return copy_literal(out, "NaN");
+    }
+    if (std::isinf(v)) {
+        return copy_literal(out, v > 0 ? "Infinity" : "-Infinity");
+    }
+
+    // the scientific form gives the digits and the exponent, e.g. -1.25e+03
+    char sci[kMaxNumericTextSize];
+    auto end = std::to_chars(sci, sci + sizeof(sci), v,
+                             std::chars_format::scientific)
+                   .ptr;
+
+    char const *p = sci;
+    std::size_t len = 0;
+    if (*p == '-') {
+        out[len++] = '-';
+        p++;
+    }
+
+    // significant digits without the decimal point
+    char digits[kMaxNumericTextSize];
+    std::size_t num_digits = 0;
+    for (; *p != 'e'; p++) {
+        if (*p != '.') {
+            digits[num_digits++] = *p;
+        }
+    }
+
+    int exponent = 0;
+    std::from_chars(p + 1 + (p[1] == '+'), end, exponent);
+
+    if (exponent < -4 || exponent >= max_exponent) {
+        out[len++] = digits[0];
+        if (num_digits > 1) {
+            out[len++] = '.';
+            std::memcpy(out + len, digits + 1, num_digits - 1);
+            len += num_digits - 1;
+        }
+        // already in the postgres form, i.e. e-05, e+15 or e+100
+        std::memcpy(out + len, p, end - p);
+        return len + (end - p);
+    }
+
+    if (exponent < 0) {
+        // 0.000ddd
+        out[len++] = '0';
+        out[len++] = '.';
+        std::memset(out + len, '0', -exponent - 1);
+        len += -exponent - 1;
+        std::memcpy(out + len, digits, num_digits);
+        return len + num_digits;
+    }
+
+    auto integral = std::size_t(exponent) + 1;
+    if (num_digits <= integral) {
+        // ddd000
+        std::memcpy(out + len, digits, num_digits);
+        len += num_digits;
+        std::memset(out + len, '0', integral - num_digits);
+        return len + integral - num_digits;
+    }
+
+    // ddd.ddd
+    std::memcpy(out + len, digits, integral);
+    len += integral;
+    out[len++] = '.';
+    std::memcpy(out + len, digits + integral, num_digits - integral);
+    return len + num_digits - integral;
+}
+
+std::size_t format_float4(char *out, float v) {
+    return format_float(out, v, 6);
+}
+
+std::size_t format_float8(char *out, double v) {
+    return format_float(out, v, 15);
+}
+
+constexpr int64_t kMicrosPerSecond = 1000000;
+constexpr int64_t kMicrosPerDay = 86400 * kMicrosPerSecond;
+
+static char *put_two_digits(char *out, unsigned v) {
+    std::memcpy(out, kDigitPairs + v * 2, 2);
+    return out + 2;
+}
+
+// civil date of the days since the unix epoch, see
+// https://howardhinnant.github.io/date_algorithms.html#civil_from_days
+static void civil_from_days(int64_t z, int64_t &y, unsigned &m, unsigned &d) {
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    auto doe = static_cast<unsigned>(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = int64_t(yoe) + era * 400 + (m <= 2);
+}
+
+// YYYY-MM-DD, the year has at least 4 digits, bc is set for the years
+// before 1 AD which are written as positive years
+static char *put_date(char *out, int64_t days, bool &bc) {
+    int64_t y;
+    unsigned m, d;
+    civil_from_days(days, y, m, d);
+    bc = y <= 0;
+    auto year = uint64_t(bc ? 1 - y : y);
+
+    if (year < 10000) {
+        out = put_two_digits(out, unsigned(year / 100));
+        out = put_two_digits(out, unsigned(year % 100));
+    } else {
+        out += format_unsigned(out, year);
+    }
+    *out++ = '-';
+    out = put_two_digits(out, m);
+    *out++ = '-';
+    return put_two_digits(out, d);
+}
+
+// HH:MM:SS with the fraction of the second only when there is one, trailing
+// zeros are trimmed. Hours aren't wrapped, intervals can have more than 24.
+static char *put_time(char *out, uint64_t micros) {
+    auto seconds = micros / kMicrosPerSecond;
+    auto fraction = unsigned(micros % kMicrosPerSecond);
+    auto hours = seconds / 3600;
+
+    if (hours < 100) {
+        out = put_two_digits(out, unsigned(hours));
+    } else {
+        out += format_unsigned(out, hours);
+    }
+    *out++ = ':';
+    out = put_two_digits(out, unsigned(seconds / 60 % 60));
+    *out++ = ':';
+    out = put_two_digits(out, unsigned(seconds % 60));
+
+    if (fraction != 0) {
+        *out++ = '.';
+        out = put_two_digits(out, fraction / 10000);
+        out = put_two_digits(out, fraction / 100 % 100);
+        out = put_two_digits(out, fraction % 100);
+        while (out[-1] == '0') {
+            out--;
+        }
+    }
+    return out;
+}
+
+std::size_t format_date(char *out, int32_t days) {
+    if (days == std::numeric_limits<int32_t>::max()) {
+        return copy_literal(out, "infinity");
+    }
+    if (days == -std::numeric_limits<int32_t>::max()) {
+        return copy_literal(out, "-infinity");
+    }
+
+    bool bc;
+    auto end = put_date(out, days, bc);
+    if (bc) {
+        end += copy_literal(end, " BC");
+    }
+    return end - out;
+}
+
+std::size_t format_time(char *out, int64_t micros) {
+    return put_time(out, uint64_t(micros)) - out;
+}
+
+static std::size_t format_timestamp(char *out, int64_t micros,
+                                    char const *zone) {
+    if (micros == std::numeric_limits<int64_t>::max()) {
+        return copy_literal(out, "infinity");
+    }
+    if (micros == -std::numeric_limits<int64_t>::max()) {
+        return copy_literal(out, "-infinity");
+    }
+
+    auto days = micros / kMicrosPerDay;
+    auto time = micros % kMicrosPerDay;
+    if (time < 0) {
+        days--;
+        time += kMicrosPerDay;
+    }
+
+    bool bc;
+    auto end = put_date(out, days, bc);
+    *end++ = ' ';
+    end = put_time(end, uint64_t(time));
+    end += copy_literal(end, zone);
+    if (bc) {
+        end += copy_literal(end, " BC");
+    }
+    return end - out;
+}
+
+std::size_t format_timestamp(char *out, int64_t micros) {
+    return format_timestamp(out, micros, "");
+}
+
+std::size_t format_timestamptz(char *out, int64_t micros) {
+    return format_timestamp(out, micros, "+00");
+}
+
+// mirrors EncodeInterval of postgres, a positive part following a negative
+// one gets an explicit + sign
+std::size_t format_interval(char *out, int32_t months, int32_t days,
+                            int64_t micros) {
+    auto end = out;
+    bool is_zero = true;
+    bool is_before = false;
+
+    auto put_part = [&](int64_t value, char const *unit) {
+        if (value == 0) {
+            return;
+        }
+        if (!is_zero) {
+            *end++ = ' ';
+        }
+        if (is_before && value > 0) {
+            *end++ = '+';
+        }
+        end += format_signed(end, value);
+        *end++ = ' ';
+        end += copy_literal(end, unit);
+        if (value != 1) {
+            *end++ = 's';
+        }
+        is_before = value < 0;
+        is_zero = false;
+    };
+
+    put_part(months / 12, "year");
+    put_part(months % 12, "mon");
+    put_part(days, "day");
+
+    if (is_zero || micros != 0) {
+        if (!is_zero) {
+            *end++ = ' ';
+        }
+        if (micros < 0) {
+            *end++ = '-';
+        } else if (is_before) {
+            *end++ = '+';
+        }
+        // negate as unsigned, -INT64_MIN doesn't fit in int64_t
+        end = put_time(end, micros < 0 ? ~uint64_t(micros) + 1
+                                       : uint64_t(micros));
+    }
+    return end - out;
+}
+
+// decimal digits of the magnitude of v without leading zeros, the 128 bits
+// are divided as 32 bit limbs so no compiler specific 128 bit type is used
+static std::size_t decimal_digits(char *out, Int128 v, bool &negative) {
+    negative = v.upper < 0;
+    uint64_t upper = uint64_t(v.upper);
+    uint64_t lower = v.lower;
+    if (negative) {
+        // two's complement negation of the 128 bits
+        upper = ~upper;
+        lower = ~lower + 1;
+        upper += lower == 0;
+    }
+
+    uint32_t limbs[4] = {uint32_t(upper >> 32), uint32_t(upper),
+                         uint32_t(lower >> 32), uint32_t(lower)};
+    std::size_t first = 0;
+
+    // 9 digits at a time, from the least significant ones
+    uint32_t chunks[5];
+    std::size_t num_chunks = 0;
+    do {
+        uint64_t remainder = 0;
+        for (std::size_t i = first; i < 4; i++) {
+            auto current = (remainder << 32) | limbs[i];
+            limbs[i] = uint32_t(current / 1000000000);
+            remainder = current % 1000000000;
+        }
+        chunks[num_chunks++] = uint32_t(remainder);
+        while (first < 4 && limbs[first] == 0) {
+            first++;
+        }
+    } while (first < 4);
+
+    auto len = format_unsigned(out, chunks[num_chunks - 1]);
+    for (std::size_t i = num_chunks - 1; i-- > 0;) {
+        // the following chunks keep their leading zeros
+        char buf[kMaxNumericTextSize];
+        auto n = format_unsigned(buf, chunks[i]);
+        std::memset(out + len, '0', 9 - n);
+        std::memcpy(out + len + 9 - n, buf, n);
+        len += 9;
+    }
+    return len;
+}
+
+std::size_t format_decimal(char *out, Int128 v, uint8_t scale) {
+    char digits[kMaxDecimalTextSize];
+    bool negative;
+    auto num_digits = decimal_digits(digits, v, negative);
+
+    std::size_t len = 0;
+    if (negative) {
+        out[len++] = '-';
+    }
+    if (num_digits <= scale) {
+        // 0.000ddd
+        out[len++] = '0';
+        out[len++] = '.';
+        std::memset(out + len, '0', scale - num_digits);
+        len += scale - num_digits;
+        std::memcpy(out + len, digits, num_digits);
+        return len + num_digits;
+    }
+
+    auto integral = num_digits - scale;
+    std::memcpy(out + len, digits, integral);
+    len += integral;
+    if (scale > 0) {
+        out[len++] = '.';
+        std::memcpy(out + len, digits + integral, scale);
+        len += scale;
+    }
+    return len;
+}
+
+std::size_t encode_decimal(Byte *out, Int128 v, uint8_t scale) {
+    constexpr uint16_t kPositive = 0x0000;
+    constexpr uint16_t kNegative = 0x4000;
+
+    // the digits are padded with zeros so that the decimal point falls on a
+    // group boundary, e.g. 12345.6 is 0001 2345 6000 with weight 1
+    char digits[kMaxDecimalTextSize + 8];
+    bool negative;
+    auto num_digits = decimal_digits(digits + 4, v, negative);
+    auto integral = int(num_digits) - scale;
+    auto lead = integral > 0 ? (4 - integral % 4) % 4 : -integral % 4;
+    std::memset(digits + 4 - lead, '0', lead);
+
+    char const *begin = digits + 4 - lead;
+    auto total = num_digits + lead;
+    total += (4 - total % 4) % 4;
+    std::memset(digits + 4 + num_digits, '0', total - num_digits - lead);
+
+    // integral groups before the point, weight is the position of the first
+    int16_t weight = int16_t((lead + integral) / 4 - 1);
+    int16_t groups[kMaxDecimalTextSize / 4 + 2];
+    int16_t num_groups = 0;
+    for (std::size_t i = 0; i < total; i += 4) {
+        auto p = begin + i;
+        groups[num_groups++] = int16_t((p[0] - '0') * 1000 +
+                                       (p[1] - '0') * 100 +
+                                       (p[2] - '0') * 10 + (p[3] - '0'));
+    }
+
+    // leading and trailing zero groups aren't sent
+    int16_t first = 0;
+    while (first < num_groups && groups[first] == 0) {
+        first++;
+        weight--;
+    }
+    while (num_groups > first && groups[num_groups - 1] == 0) {
+        num_groups--;
+    }
+    if (first == num_groups) {
+        weight = 0;
+        negative = false;
+    }
+
+    auto p = out;
+    endian::network::put<int16_t>(int16_t(num_groups - first), p);
+    endian::network::put<int16_t>(weight, p + 2);
+    endian::network::put<uint16_t>(negative ? kNegative : kPositive, p + 4);
+    endian::network::put<int16_t>(int16_t(scale), p + 6);
+    p += 8;
+    for (auto i = first; i < num_groups; i++, p += 2) {
+        endian::network::put<int16_t>(groups[i], p);
+    }
+    return p - out;
+}
+
+std::size_t format_uuid(char *out, Byte const *bytes) {
+    auto p = out;
+    std::size_t const groups[] = {4, 2, 2, 2, 6};
+    for (auto size : groups) {
+        if (p != out) {
+            *p++ = '-';
+        }
+        format_hex(p, bytes, size);
+        p += size * 2;
+        bytes += size;
+    }
+    return p - out;
+}
+
+} // namespace pgwire
@@ -0,0 +1,160 @@
+#include <cstring>
+
+#include <pgwire/format.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PGWIRE_HEX_X86 1
+#include <emmintrin.h>
+#if defined(__GNUC__)
+// AVX2 is compiled through the target attribute and only used when the cpu
+// reports it, the rest of the library stays at the baseline
+#define PGWIRE_HEX_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+namespace pgwire {
+
+// the two hex digits of every byte value, i.e. "000102...feff"
+struct HexPairs {
+    char digits[512];
+
+    constexpr HexPairs() : digits() {
+        constexpr char hex[] = "0123456789abcdef";
+        for (int i = 0; i < 256; i++) {
+            digits[i * 2] = hex[i >> 4];
+            digits[i * 2 + 1] = hex[i & 0xf];
+        }
+    }
+};
+
+static constexpr HexPairs kHexPairs;
+
+static void format_hex_scalar(char *out, Byte const *data, std::size_t size) {
+    for (std::size_t i = 0; i < size; i++) {
+        std::memcpy(out + i * 2, kHexPairs.digits + data[i] * 2, 2);
+    }
+}
+
+#ifdef PGWIRE_HEX_X86
+// nibbles to their ascii digit, '0' + n and another 39 to reach 'a' for
+// the nibbles above 9
+static inline __m128i hex_digits_sse2(__m128i nibbles) {
+    auto letters = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+    auto digits = _mm_add_epi8(nibbles, _mm_set1_epi8('0'));
+    return _mm_add_epi8(digits, _mm_and_si128(letters, _mm_set1_epi8(39)));
+}
+
+static void format_hex_sse2(char *out, Byte const *data, std::size_t size) {
+    auto mask = _mm_set1_epi8(0x0f);
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data + i));
+        auto hi = hex_digits_sse2(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        auto lo = hex_digits_sse2(_mm_and_si128(v, mask));
+
+        // the high digit of every byte comes first
+        auto p = reinterpret_cast<__m128i *>(out + i * 2);
+        _mm_storeu_si128(p, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128(p + 1, _mm_unpackhi_epi8(hi, lo));
+    }
+    format_hex_scalar(out + i * 2, data + i, size - i);
+}
+#endif
+
+#ifdef PGWIRE_HEX_AVX2
+__attribute__((target("avx2"))) static inline __m256i
+hex_digits_avx2(__m256i nibbles) {
+    auto letters = _mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9));
+    auto digits = _mm256_add_epi8(nibbles, _mm256_set1_epi8('0'));
+    return _mm256_add_epi8(digits,
+                           _mm256_and_si256(letters, _mm256_set1_epi8(39)));
+}
+
+__attribute__((target("avx2"))) static void
+format_hex_avx2(char *out, Byte const *data, std::size_t size) {
+    auto mask = _mm256_set1_epi8(0x0f);
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        auto v =
+            _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + i));
+        auto hi =
+            hex_digits_avx2(_mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+        auto lo = hex_digits_avx2(_mm256_and_si256(v, mask));
+
+        // unpack interleaves within the 128 bit lanes, the permutes put the
+        // lanes back in order
+        auto first = _mm256_unpacklo_epi8(hi, lo);
+        auto second = _mm256_unpackhi_epi8(hi, lo);
+        auto p = reinterpret_cast<__m256i *>(out + i * 2);
+        _mm256_storeu_si256(p, _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256(p + 1,
+                            _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    format_hex_sse2(out + i * 2, data + i, size - i);
+}
+#endif
+
+bool hex_kernel_supported(HexKernel kernel) {
+    switch (kernel) {
+    case HexKernel::Scalar:
+        return true;
+    case HexKernel::Sse2:
+#ifdef PGWIRE_HEX_X86
+        return true;
+#else
+        return false;
+#endif
+    case HexKernel::Avx2:
+#ifdef PGWIRE_HEX_AVX2
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+static HexKernel detect_hex_kernel() {
+    for (auto kernel : {HexKernel::Avx2, HexKernel::Sse2}) {
+        if (hex_kernel_supported(kernel)) {
+            return kernel;
+        }
+    }
+    return HexKernel::Scalar;
+}
+
+HexKernel hex_kernel() {
+    static HexKernel const kernel = detect_hex_kernel();
+    return kernel;
+}
+
+void format_hex(char *out, Byte const *data, std::size_t size,
+                HexKernel kernel) {
+    switch (kernel) {
+#ifdef PGWIRE_HEX_AVX2
+    case HexKernel::Avx2:
+        format_hex_avx2(out, data, size);
+        return;
+#endif
+#ifdef PGWIRE_HEX_X86
+    case HexKernel::Sse2:
+        format_hex_sse2(out, data, size);
+        return;
+#endif
+    default:
+        format_hex_scalar(out, data, size);
+        return;
+    }
+}
+
+void format_hex(char *out, Byte const *data, std::size_t size) {
+    // short values, e.g. uuids, don't fill a register
+    if (size < 16) {
+        format_hex_scalar(out, data, size);
+        return;
+    }
+    format_hex(out, data, size, hex_kernel());
+}
+
+} // namespace pgwire
@@ -1,3 +1,5 @@
+#include <deque>
+
 #include <pgwire/io.hpp>
 
 namespace pgwire::io {
@@ -11,10 +13,14 @@ class StreamWriterImpl {
     ~StreamWriterImpl();
     Promise write(char const *message, std::size_t size);
 
+  private:
+    void do_write();
+
   private:
     FILE *_file;
     asio::writable_pipe _pipe;
     bool _close;
+    std::deque<std::string> _queue;
 };
 
 shared_buffer::shared_buffer(Bytes &&bytes)
@@ -44,7 +50,32 @@ StreamWriterImpl::~StreamWriterImpl() {
 }
 
 Promise StreamWriterImpl::write(char const *message, std::size_t size) {
-    return async_write(_pipe, asio::buffer(message, size));
+    // writers may live on other I/O threads, so the message is copied and
+    // handed to the pipe's own executor which serializes the writes
+    asio::post(_pipe.get_executor(),
+               [this, message = std::string(message, size)]() mutable {
+                   _queue.push_back(std::move(message));
+                   if (_queue.size() == 1) {
+                       do_write();
+                   }
+               });
+    return resolve();
+}
+
+void StreamWriterImpl::do_write() {
+    asio::async_write(_pipe, asio::buffer(_queue.front()),
+                      [this](error_code err, std::size_t) {
+                          if (err) {
+                              // drop the pending lines, nowhere to report
+                              _queue.clear();
+                              return;
+                          }
+
+                          _queue.pop_front();
+                          if (!_queue.empty()) {
+                              do_write();
+                          }
+                      });
 }
 
 StreamWriter::StreamWriter(asio::io_context &context, FILE *file)
@@ -1,17 +1,19 @@
 #include "pgwire/types.hpp"
+#include <algorithm>
 #include <cstdint>
-#include <optional>
 #include <pgwire/protocol.hpp>
 
 namespace pgwire {
 
-void encode(Buffer &b, BackendMessage const &msg) {
-    Buffer body;
-    msg.encode(body);
-
-    b.put_numeric<uint8_t>(uint8_t(msg.tag()));
-    b.put_numeric<int32_t>(body.size() + sizeof(int32_t));
-    b.put_bytes(body.data());
+// the body is written in place, its length is filled in afterwards
+template <typename Body>
+static void put_framed(Buffer &b, BackendTag tag, Body &&body) {
+    b.put_numeric<uint8_t>(uint8_t(tag));
+    auto length_offset = b.data().size();
+    b.put_numeric<int32_t>(0);
+    body();
+    b.set_numeric<int32_t>(length_offset,
+                           int32_t(b.data().size() - length_offset));
 }
 
 void encode(Buffer &b, SSLResponse const &ssl_resp) {
@@ -22,92 +24,62 @@ void encode(Buffer &b, SSLResponse const &ssl_resp) {
     }
 }
 
-BackendTag AuthenticationOk::tag() const noexcept {
-    return BackendTag::Authentication;
-}
-
-void AuthenticationOk::encode(Buffer &b) const { b.put_numeric<int32_t>(0); }
-
-ParameterStatus::ParameterStatus(std::string name, std::string value)
-    : name(std::move(name)), value(std::move(value)) {}
-
-BackendTag ParameterStatus::tag() const noexcept {
-    return BackendTag::ParameterStatus;
-}
-
-void ParameterStatus::encode(Buffer &b) const {
-    b.put_string(name);
-    b.put_string(value);
-}
-
-ReadyForQuery::ReadyForQuery(Status status) : status(status) {}
-
-BackendTag ReadyForQuery::tag() const noexcept {
-    return BackendTag::ReadyForQuery;
-}
-void ReadyForQuery::encode(Buffer &b) const {
-    switch (status) {
-    case Idle:
-        b.put_numeric('I');
-        break;
-    case Block:
-        b.put_numeric('T');
-        break;
-    case Failed:
-        b.put_numeric('E');
-        break;
+FormatCode format_code_at(std::vector<FormatCode> const &format_codes,
+                          std::size_t n) {
+    if (format_codes.empty()) {
+        return FormatCode::Text;
     }
+    if (format_codes.size() == 1 || n >= format_codes.size()) {
+        return format_codes[0];
+    }
+    return format_codes[n];
 }
 
-RowDescription::RowDescription(std::vector<FieldDescription> fields,
-                               FormatCode format_code)
-    : fields(std::move(fields)), format_code(format_code) {}
-
-BackendTag RowDescription::tag() const noexcept {
-    return BackendTag::RowDescription;
-}
-
-void RowDescription::encode(Buffer &b) const {
+static void
+encode_row_description(Buffer &b, Fields const &fields,
+                       std::vector<FormatCode> const &format_codes) {
     b.put_numeric<int16_t>(fields.size());
-    for (const auto &field : fields) {
+    for (std::size_t i = 0; i < fields.size(); i++) {
+        auto const &field = fields[i];
         b.put_string(field.name);
         b.put_numeric<int32_t>(0);
         b.put_numeric<int16_t>(0);
         b.put_numeric(int32_t(field.oid));
         b.put_numeric(get_oid_size(field.oid));
         b.put_numeric<int32_t>(-1);
-        b.put_numeric(int16_t(format_code));
+        b.put_numeric(int16_t(format_code_at(format_codes, i)));
     }
 }
 
-CommandComplete::CommandComplete(std::string command_tag)
-    : command_tag(std::move(command_tag)) {}
-
-BackendTag CommandComplete::tag() const noexcept {
-    return BackendTag::CommandComplete;
+void put_row_description(Buffer &b, Fields const &fields,
+                         std::vector<FormatCode> const &format_codes) {
+    put_framed(b, BackendTag::RowDescription,
+               [&] { encode_row_description(b, fields, format_codes); });
 }
-void CommandComplete::encode(Buffer &b) const { b.put_string(command_tag); }
-
-ErrorResponse::ErrorResponse(std::string message, SqlState state,
-                             ErrorSeverity severity)
-    : message(std::move(message)), severity(severity), sql_state(state) {}
 
-BackendTag ErrorResponse::tag() const noexcept {
-    return BackendTag::ErrorResponse;
+static void encode_parameter_description(Buffer &b,
+                                         std::vector<Oid> const &types) {
+    b.put_numeric<int16_t>(types.size());
+    for (auto oid : types) {
+        b.put_numeric(int32_t(oid));
+    }
 }
-void ErrorResponse::encode(Buffer &b) const {
-    b.put_byte('S').put_string(get_error_severity(severity));
-    b.put_byte('C').put_string(get_sqlstate_code(sql_state));
-    b.put_byte('M').put_string(message);
-    b.put_byte(0);
+
+void put_parameter_description(Buffer &b, std::vector<Oid> const &types) {
+    put_framed(b, BackendTag::ParameterDescription,
+               [&] { encode_parameter_description(b, types); });
 }
 
 FrontendType StartupMessage::type() const noexcept {
-    return is_ssl_request ? FrontendType::SSLRequest : FrontendType::Startup;
+    if (is_ssl_request) {
+        return FrontendType::SSLRequest;
+    }
+    return is_cancel_request ? FrontendType::CancelRequest
+                             : FrontendType::Startup;
 }
 FrontendTag StartupMessage::tag() const noexcept { return FrontendTag::None; }
 
-void StartupMessage::decode(Buffer &b) {
+void StartupMessage::decode(BufferView &b) {
     this->major_version = b.get_numeric<int16_t>();
     this->minor_version = b.get_numeric<int16_t>();
 
@@ -116,46 +88,112 @@ void StartupMessage::decode(Buffer &b) {
         return;
     }
 
-    size_t start = 0;
-    std::optional<std::string> key;
-    for (size_t i = 0; i < b.size(); i++) {
-        auto current = b.at(i);
-        // look for null termination
-        if (current != '\0')
-            continue;
-
-        // found null termination read the string
-        std::string value{b.buffer() + start, b.buffer() + i};
-        start = i + 1;
+    if (major_version == 1234 && minor_version == 5678) {
+        is_cancel_request = true;
+        process_id = b.get_numeric<int32_t>();
+        secret_key = b.get_numeric<int32_t>();
+        return;
+    }
 
-        // non existing key, put to temporary string
-        if (!key) {
-            key = std::move(value);
-            continue;
+    // list of key and value pairs terminated by an empty key
+    while (b.size() > 0) {
+        auto key = b.get_string();
+        if (key.empty()) {
+            break;
         }
 
-        if (key) {
-            if (key == "user") {
-                this->user = std::move(value);
-            } else if (key == "database") {
-                this->database = std::move(value);
-            } else if (key == "options") {
-                this->options = std::move(value);
-            }
-            // reset the key
-            key = std::nullopt;
+        auto value = b.get_string();
+        if (key == "user") {
+            this->user = value;
+        } else if (key == "database") {
+            this->database = value;
+        } else if (key == "options") {
+            this->options = value;
         }
-    };
+    }
 }
 
 FrontendType Query::type() const noexcept { return FrontendType::Query; }
 FrontendTag Query::tag() const noexcept { return FrontendTag::Query; }
-void Query::decode(Buffer &b) { query = b.get_string(); }
+void Query::decode(BufferView &b) { query = b.get_string(); }
+
+// format codes are sent as a count followed by that many codes, decoded into
+// codes to keep its capacity when the message is reused
+static void decode_format_codes(BufferView &b, std::vector<FormatCode> &codes) {
+    auto n = b.get_numeric<int16_t>();
+    codes.clear();
+    for (int16_t i = 0; i < n; i++) {
+        codes.push_back(FormatCode(b.get_numeric<int16_t>()));
+    }
+}
+
+FrontendType Parse::type() const noexcept { return FrontendType::Parse; }
+FrontendTag Parse::tag() const noexcept { return FrontendTag::Parse; }
+void Parse::decode(BufferView &b) {
+    name = b.get_string();
+    query = b.get_string();
+
+    auto n = b.get_numeric<int16_t>();
+    parameter_types.clear();
+    for (int16_t i = 0; i < n; i++) {
+        parameter_types.push_back(b.get_numeric<oid_t>());
+    }
+}
+
+FrontendType Bind::type() const noexcept { return FrontendType::Bind; }
+FrontendTag Bind::tag() const noexcept { return FrontendTag::Bind; }
+void Bind::decode(BufferView &b) {
+    portal = b.get_string();
+    statement = b.get_string();
+    decode_format_codes(b, parameter_formats);
+
+    auto n = b.get_numeric<int16_t>();
+    parameters.clear();
+    for (int16_t i = 0; i < n; i++) {
+        auto len = b.get_numeric<int32_t>();
+        if (len < 0) {
+            parameters.emplace_back(std::nullopt);
+            continue;
+        }
+        parameters.emplace_back(b.get_bytes(len));
+    }
+
+    decode_format_codes(b, result_formats);
+}
+
+FrontendType Describe::type() const noexcept { return FrontendType::Describe; }
+FrontendTag Describe::tag() const noexcept { return FrontendTag::Describe; }
+void Describe::decode(BufferView &b) {
+    target = DescribeTarget(b.get_numeric<Byte>());
+    name = b.get_string();
+}
+
+FrontendType Execute::type() const noexcept { return FrontendType::Execute; }
+FrontendTag Execute::tag() const noexcept { return FrontendTag::Execute; }
+void Execute::decode(BufferView &b) {
+    portal = b.get_string();
+    max_rows = b.get_numeric<int32_t>();
+}
+
+FrontendType Close::type() const noexcept { return FrontendType::Close; }
+FrontendTag Close::tag() const noexcept { return FrontendTag::Close; }
+void Close::decode(BufferView &b) {
+    target = DescribeTarget(b.get_numeric<Byte>());
+    name = b.get_string();
+}
+
+FrontendType Sync::type() const noexcept { return FrontendType::Sync; }
+FrontendTag Sync::tag() const noexcept { return FrontendTag::Sync; }
+void Sync::decode(BufferView &b) {}
+
+FrontendType Flush::type() const noexcept { return FrontendType::Flush; }
+FrontendTag Flush::tag() const noexcept { return FrontendTag::Flush; }
+void Flush::decode(BufferView &b) {}
 
 FrontendType Terminate::type() const noexcept {
     return FrontendType::Terminate;
 }
 FrontendTag Terminate::tag() const noexcept { return FrontendTag::Terminate; }
-void Terminate::decode(Buffer &b) {}
+void Terminate::decode(BufferView &b) {}
 
 } // namespace pgwire
@@ -1,8 +1,13 @@
+#include <algorithm>
 #include <atomic>
 #include <cstddef>
 #include <cstdio>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <pgwire/io.hpp>
 #include <pgwire/log.hpp>
@@ -23,56 +28,231 @@ using PromisePtr = std::shared_ptr<Promise>;
 
 static std::atomic<std::size_t> sess_id_counter = 0;
 
+#ifdef SO_REUSEPORT
+// SO_REUSEPORT as a settable socket option, asio has none for it so it is
+// declared the way asio documents for custom options
+class reuse_port {
+  public:
+    explicit reuse_port(bool enabled) : _value(enabled ? 1 : 0) {}
+
+    template <typename Protocol> int level(Protocol const &) const {
+        return SOL_SOCKET;
+    }
+    template <typename Protocol> int name(Protocol const &) const {
+        return SO_REUSEPORT;
+    }
+    template <typename Protocol> void const *data(Protocol const &) const {
+        return &_value;
+    }
+    template <typename Protocol> std::size_t size(Protocol const &) const {
+        return sizeof(_value);
+    }
+
+  private:
+    int _value;
+};
+#endif
+
+// Worker is a single I/O thread, it owns its acceptor so accepted sessions
+// are pinned to the worker's io_context for their whole lifetime.
+struct Worker {
+    Worker(asio::io_context &io_context);
+    Worker(std::unique_ptr<asio::io_context> &&io_context);
+
+    asio::io_context &context;
+    std::unique_ptr<asio::io_context> owned_context;
+    std::optional<asio::ip::tcp::acceptor> acceptor;
+    std::optional<asio::executor_work_guard<asio::io_context::executor_type>>
+        work;
+};
+
 class ServerImpl {
   public:
     ServerImpl(asio::io_context &io_context, asio::ip::tcp::endpoint endpoint,
-               Handler &&handler);
-    void do_accept();
+               Handler &&handler, AsyncHandler &&async_handler,
+               std::size_t num_threads);
+    void do_accept(Worker &worker);
+    void start_session(asio::ip::tcp::socket &&socket);
+    // cancel serves a CancelRequest for the session id
+    void cancel(SessionID id, int32_t key);
 
   private:
     friend class Server;
 
     asio::io_context &_io_context;
-    asio::ip::tcp::acceptor _acceptor;
+    asio::ip::tcp::endpoint _endpoint;
     Handler _handler;
+    AsyncHandler _async_handler;
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::atomic<std::size_t> _next_worker = 0;
+
+    std::mutex _sessions_mutex;
     std::unordered_map<SessionID, SessionPtr> _sessions;
 };
 
+Worker::Worker(asio::io_context &io_context) : context(io_context) {}
+
+Worker::Worker(std::unique_ptr<asio::io_context> &&io_context)
+    : context(*io_context), owned_context(std::move(io_context)) {}
+
+static asio::ip::tcp::acceptor make_acceptor(asio::io_context &io_context,
+                                             asio::ip::tcp::endpoint endpoint,
+                                             bool shared) {
+    asio::ip::tcp::acceptor acceptor{io_context};
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+    if (shared) {
+        acceptor.set_option(reuse_port(true));
+    }
+#endif
+    acceptor.bind(endpoint);
+    acceptor.listen();
+    return acceptor;
+}
+
 Server::Server(asio::io_context &io_context, asio::ip::tcp::endpoint endpoint,
-               Handler &&handler)
+               Handler &&handler, std::size_t num_threads)
     : _impl(std::make_unique<ServerImpl>(io_context, endpoint,
-                                         std::move(handler))) {}
+                                         std::move(handler), nullptr,
+                                         num_threads)) {}
+
+Server::Server(asio::io_context &io_context, asio::ip::tcp::endpoint endpoint,
+               AsyncHandler &&handler, std::size_t num_threads)
+    : _impl(std::make_unique<ServerImpl>(io_context, endpoint, nullptr,
+                                         std::move(handler), num_threads)) {}
 
 Server::~Server() = default;
 
 void Server::start() {
-    _impl->do_accept();
+    for (auto &worker : _impl->_workers) {
+        if (worker->acceptor) {
+            _impl->do_accept(*worker);
+        }
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(_impl->_workers.size() - 1);
+    for (std::size_t i = 1; i < _impl->_workers.size(); i++) {
+        auto &context = _impl->_workers[i]->context;
+        threads.emplace_back([&context] { context.run(); });
+    }
+
     _impl->_io_context.run();
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
 }
 
 ServerImpl::ServerImpl(asio::io_context &io_context,
-                       asio::ip::tcp::endpoint endpoint, Handler &&handler)
-    : _io_context{io_context}, _acceptor{io_context, endpoint},
-      _handler(std::move(handler)) {};
+                       asio::ip::tcp::endpoint endpoint, Handler &&handler,
+                       AsyncHandler &&async_handler, std::size_t num_threads)
+    : _io_context{io_context}, _endpoint{endpoint},
+      _handler(std::move(handler)), _async_handler(std::move(async_handler)) {
+    num_threads = std::max<std::size_t>(num_threads, 1);
+    bool shared = num_threads > 1;
+
+    _workers.reserve(num_threads);
+    _workers.push_back(std::make_unique<Worker>(io_context));
+    for (std::size_t i = 1; i < num_threads; i++) {
+        _workers.push_back(
+            std::make_unique<Worker>(std::make_unique<asio::io_context>(1)));
+    }
 
-void ServerImpl::do_accept() {
-    _acceptor.async_accept(
-        [this](std::error_code ec, asio::ip::tcp::socket socket) {
+#ifdef SO_REUSEPORT
+    // every worker listens on its own socket and lets the kernel balance
+    for (auto &worker : _workers) {
+        worker->acceptor.emplace(
+            make_acceptor(worker->context, endpoint, shared));
+    }
+#else
+    // no SO_REUSEPORT, the first worker accepts and hands the connections
+    // to the other workers in round-robin fashion
+    _workers.front()->acceptor.emplace(
+        make_acceptor(io_context, endpoint, shared));
+    for (std::size_t i = 1; i < _workers.size(); i++) {
+        // keep idle workers running until the acceptor gives them a session
+        auto &worker = _workers[i];
+        worker->work.emplace(asio::make_work_guard(worker->context));
+    }
+#endif
+};
+
+void ServerImpl::do_accept(Worker &worker) {
+#ifdef SO_REUSEPORT
+    // the kernel already balances the connections between the workers
+    auto &context = worker.context;
+#else
+    auto &context = _workers[_next_worker++ % _workers.size()]->context;
+#endif
+
+    worker.acceptor->async_accept(
+        context, [this, &worker](std::error_code ec,
+                                 asio::ip::tcp::socket socket) {
             if (!ec) {
-                SessionID id = ++sess_id_counter;
-                log::info("[session #%d] started", id);
-                auto session = std::make_shared<Session>(id, std::move(socket));
-                session->set_handler(_handler(*session));
-                auto promise = session->start().finally([this, session] {
-                    log::info("[session #%d] done", session->id());
-                    _sessions.erase(session->id());
-                });
-
-                _sessions.emplace(id, session);
+                // start the session on the thread that owns its socket
+                auto executor = socket.get_executor();
+                asio::dispatch(executor,
+                               [this, socket = std::move(socket)]() mutable {
+                                   start_session(std::move(socket));
+                               });
             }
 
-            do_accept();
+            do_accept(worker);
         });
 }
 
+void ServerImpl::start_session(asio::ip::tcp::socket &&socket) {
+    SessionID id = ++sess_id_counter;
+    log::info("[session #%d] started", id);
+    auto session = std::make_shared<Session>(id, std::move(socket));
+    if (_async_handler) {
+        session->set_handler(_async_handler(*session));
+    } else {
+        session->set_handler(_handler(*session));
+    }
+
+    session->_cancel_request = [this](SessionID id, int32_t key) {
+        cancel(id, key);
+    };
+
+    {
+        std::lock_guard lock{_sessions_mutex};
+        _sessions.emplace(id, session);
+    }
+
+    auto done = [this, session] {
+        auto const &stats = session->stats();
+        log::info("[session #%d] done, decoded %lu messages in %lu reads",
+                  session->id(), stats.messages_decoded, stats.read_calls);
+        // a suspended portal's producer refers to the session
+        session->close_portals();
+        std::lock_guard lock{_sessions_mutex};
+        _sessions.erase(session->id());
+    };
+
+#ifdef PGWIRE_USE_COROUTINES
+    asio::co_spawn(session->_socket.get_executor(), session->run(),
+                   [done](std::exception_ptr) { done(); });
+#else
+    auto promise = session->start().finally(done);
+#endif
+}
+
+void ServerImpl::cancel(SessionID id, int32_t key) {
+    SessionPtr session;
+    {
+        std::lock_guard lock{_sessions_mutex};
+        auto it = _sessions.find(id);
+        if (it == _sessions.end()) {
+            return;
+        }
+        session = it->second;
+    }
+
+    log::info("[session #%d] cancel requested", id);
+    session->cancel(key);
+}
+
 } // namespace pgwire
@@ -1,7 +1,13 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 #include <iomanip>
+#include <limits>
+#include <random>
 #include <sstream>
 
 #include <pgwire/exception.hpp>
+#include <pgwire/format.hpp>
 #include <pgwire/log.hpp>
 #include <pgwire/session.hpp>
 #include <pgwire/utils.hpp>
@@ -11,6 +17,12 @@ namespace pgwire {
 using QueryId = int64_t;
 static std::atomic<QueryId> id_counter = 0;
 
+// amount of queued bytes that triggers a write before the next flush point
+constexpr std::size_t kCorkThreshold = 64 * 1024;
+// initial receive buffer size and the least room left for a single read
+constexpr std::size_t kReceiveBufferSize = 16 * 1024;
+constexpr std::size_t kMinReceiveSize = 4 * 1024;
+
 static std::unordered_map<std::string, std::string> server_status = {
     {"server_version", "14"},     {"server_encoding", "UTF-8"},
     {"client_encoding", "UTF-8"}, {"DateStyle", "ISO"},
@@ -18,9 +30,9 @@ static std::unordered_map<std::string, std::string> server_status = {
 };
 
 Session::Session(SessionID id, asio::ip::tcp::socket &&socket)
-    : _id(id), _startup_done(false), _socket{std::move(socket)} {
-
-      };
+    : _id(id), _startup_done(false), _socket{std::move(socket)},
+      _secret_key(int32_t(std::random_device{}())),
+      _statement_timer(_socket.get_executor()) {}
 
 Session::~Session() = default;
 
@@ -28,9 +40,13 @@ void Session::set_handler(ParseHandler &&handler) {
     _handler = std::move(handler);
 }
 
+void Session::set_handler(AsyncParseHandler &&handler) {
+    _async_handler = std::move(handler);
+}
+
 Promise Session::start() {
     return newPromise([this](Defer &defer) {
-        newPromise([=](Defer &read_defer) {
+        newPromise([this](Defer &read_defer) {
             do_read(read_defer);
         }).fail([defer] { defer.resolve(); });
     });
@@ -38,113 +54,304 @@ Promise Session::start() {
 
 SessionID Session::id() const { return _id; }
 
+SessionStats const &Session::stats() const { return _stats; }
+
+ArenaStats const &Session::arena_stats() const { return _arena.stats(); }
+
+ReadyForQuery::Status Session::transaction_status() const {
+    return _transaction_status;
+}
+
+void Session::set_transaction_status(ReadyForQuery::Status status) {
+    _transaction_status = status;
+}
+
+Executor Session::executor() { return _socket.get_executor(); }
+
+int32_t Session::secret_key() const { return _secret_key; }
+
+void Session::cancel(int32_t key) {
+    if (key != _secret_key) {
+        log::info("[session #%d] cancel request with a wrong key", _id);
+        return;
+    }
+
+    std::lock_guard lock{_cancel_mutex};
+    interrupt(Cancel::UserRequest, _statement);
+}
+
+void Session::set_cancel_handler(CancelHandler &&handler) {
+    std::lock_guard lock{_cancel_mutex};
+    _cancel_handler = std::move(handler);
+}
+
+void Session::set_statement_timeout(std::chrono::milliseconds timeout) {
+    _statement_timeout = timeout;
+}
+
+// called with _cancel_mutex held
+void Session::interrupt(Cancel reason, std::size_t statement) {
+    if (!_running || statement != _statement ||
+        _cancelled != Cancel::None) {
+        return;
+    }
+
+    log::info("[session #%d] cancelling the running statement", _id);
+    _cancelled = reason;
+    if (_cancel_handler) {
+        _cancel_handler();
+    }
+}
+
+void Session::begin_statement() {
+    std::size_t statement;
+    {
+        std::lock_guard lock{_cancel_mutex};
+        statement = ++_statement;
+        _running = true;
+        _cancelled = Cancel::None;
+    }
+
+    if (_statement_timeout.count() > 0) {
+        _statement_timer.expires_after(_statement_timeout);
+        _statement_timer.async_wait(
+            [this, self = shared_from_this(), statement](io::error_code err) {
+                if (!err) {
+                    std::lock_guard lock{_cancel_mutex};
+                    interrupt(Cancel::StatementTimeout, statement);
+                }
+            });
+    }
+}
+
+Session::Cancel Session::end_statement() {
+    if (_statement_timeout.count() > 0) {
+        _statement_timer.cancel();
+    }
+
+    std::lock_guard lock{_cancel_mutex};
+    _running = false;
+    return _cancelled;
+}
+
+// a cancelled statement fails with QueryCanceled, whatever the handler
+// reported
+static SqlException cancel_error(bool timeout) {
+    return SqlException{timeout
+                            ? "canceling statement due to statement timeout"
+                            : "canceling statement due to user request",
+                        SqlState::QueryCanceled};
+}
+
+// a query of nothing but whitespace and semicolons has no statement
+static bool is_empty_query(std::string_view query) {
+    return std::all_of(query.begin(), query.end(), [](char c) {
+        return c == ';' || std::isspace(static_cast<unsigned char>(c));
+    });
+}
+
 void Session::do_read(Defer defer) {
-    this->read().then([=](FrontendMessagePtr message) {
+    this->read().then([this, defer](FrontendMessagePtr message) {
         if (!message) {
             do_read(defer);
             return;
         }
 
         process_message(message)
-            .then([=]() { do_read(defer); })
-            .fail([=](SqlExceptionPtr e) {
+            .then([this, defer]() { do_read(defer); })
+            .fail([this, defer](SqlExceptionPtr e) {
                 if (e->get_severity() == ErrorSeverity::Fatal) {
                     defer.reject(e);
                     return;
                 }
 
-                ErrorResponse error_responsse{
-                    e->get_message(), e->get_sqlstate(), e->get_severity()};
-                this->write(encode_bytes(error_responsse)).then([this] {
-                    return this->write(encode_bytes(ReadyForQuery{}));
-                });
-                do_read(defer);
+                send_error(*e);
+                this->ready()
+                    .then([this, defer] { do_read(defer); })
+                    .fail([defer] { defer.reject(); });
             })
-            .fail([=] { defer.reject(); });
-    });
+            .fail([defer] { defer.reject(); });
+    }).fail([defer] { defer.reject(); });
 }
 
 Promise Session::process_message(FrontendMessagePtr msg) {
-    switch (msg->type()) {
+    Step step;
+    try {
+        step = handle(*msg);
+    } catch (SqlException &e) {
+        return reject(std::make_shared<SqlException>(std::move(e)));
+    }
+    return follow(step);
+}
+
+Promise Session::follow(Step step) {
+    switch (step) {
+    case Step::Read:
+        break;
+    case Step::Flush:
+        return this->flush();
+    case Step::Ready:
+        return this->ready();
+    case Step::Close:
+        return reject();
+    case Step::Wait:
+        return newPromise([this](Defer &defer) {
+            _resume = [this, defer](Step next) {
+                follow(next)
+                    .then([defer] { defer.resolve(); })
+                    .fail([defer] { defer.reject(); });
+            };
+        });
+    }
+    return resolve();
+}
+
+void Session::resume(Step step) {
+    // the continuation may start another handler and set _resume again
+    auto resume = std::move(_resume);
+    _resume = nullptr;
+    resume(step);
+}
+
+Session::Step Session::fail(SqlException const &e, bool extended) {
+    if (e.get_severity() == ErrorSeverity::Fatal) {
+        return Step::Close;
+    }
+
+    log::info("[session #%d] %s failed, error = %s", _id,
+              extended ? "extended query" : "query", e.what());
+    send_error(e);
+    if (!extended) {
+        return Step::Ready;
+    }
+
+    // ReadyForQuery is sent once the client syncs
+    _skip_till_sync = true;
+    return Step::Read;
+}
+
+Session::Step Session::handle(FrontendMessage &msg) {
+    // after an error in the extended protocol everything up to the next Sync
+    // is discarded
+    if (_skip_till_sync && msg.type() != FrontendType::Sync &&
+        msg.type() != FrontendType::Terminate) {
+        return Step::Read;
+    }
+
+    switch (msg.type()) {
     case FrontendType::Invalid:
     case FrontendType::Startup:
-        return this->write(encode_bytes(AuthenticationOk{}))
-            .then([this] {
-                Promise promise = resolve();
-                for (auto const &it : server_status) {
-                    std::string key = it.first;
-                    std::string value = it.second;
-                    promise = promise.then([this, key, value] {
-                        return this->write(
-                            encode_bytes(ParameterStatus{key, value}));
-                    });
-                }
-                return promise;
-            })
-            .then(
-                [this] { return this->write(encode_bytes(ReadyForQuery{})); });
+        this->send(kAuthenticationOk);
+        for (auto const &it : server_status) {
+            this->send_message(BackendTag::ParameterStatus, it.first,
+                               it.second);
+        }
+        // the key the client cancels the session's statements with
+        this->send_message(BackendTag::BackendKeyData, int32_t(_id),
+                           _secret_key);
+        return Step::Ready;
     case FrontendType::SSLRequest:
-        return this->write(encode_bytes(SSLResponse{}));
+        this->send(SSLResponse{});
+        return Step::Flush;
+    case FrontendType::CancelRequest: {
+        // the request comes on a connection of its own, which is closed
+        // without a response
+        auto &request = static_cast<StartupMessage &>(msg);
+        if (_cancel_request) {
+            _cancel_request(SessionID(uint32_t(request.process_id)),
+                            request.secret_key);
+        }
+        return Step::Close;
+    }
     case FrontendType::Query: {
-        auto *query = static_cast<Query *>(msg.get());
+        auto &query = static_cast<Query &>(msg);
         auto id = ++id_counter;
+        auto quoted = string_escape_space(
+            (std::stringstream() << std::quoted(query.query)).str() //
+        );
+        auto timer = timer_start();
+        log::info("[session #%d] [query #%d] executing query %s", _id, id,
+                  quoted.c_str());
+        auto done = [this, id, timer] {
+            auto elapsed = duration_string(timer.elapsed());
+            log::info("[session #%d] [query #%d] query done, elapsed = %s",
+                      _id, id, elapsed.c_str());
+            return Step::Ready;
+        };
+        if (is_empty_query(query.query)) {
+            this->send(kEmptyQueryResponse);
+            return done();
+        }
         try {
-            auto quoted = string_escape_space(
-                (std::stringstream() << std::quoted(query->query)).str() //
-            );
-            auto timer = timer_start();
-            log::info("[session #%d] [query #%d] executing query %s", _id, id,
-                      quoted.c_str());
-            // use shared_ptr to extend PreparedStatement, so it can outlive
-            // this function
-            auto prepared =
-                std::make_shared<PreparedStatement>((*_handler)(query->query));
-            return this->write(encode_bytes(RowDescription{prepared->fields}))
-                .then([this, prepared] {
-                    Writer writer{prepared->fields.size()};
-                    try {
-                        prepared->handler(writer, {});
-                    } catch (SqlException &e) {
-                        return reject(
-                            std::make_shared<SqlException>(std::move(e)));
-                    }
-
-                    return this->write(encode_bytes(writer))
-                        .then([this, num_rows = writer.num_rows()] {
-                            return this->write(encode_bytes(CommandComplete{
-                                string_format("SELECT %lu", num_rows)}));
+            return prepare(
+                query.query,
+                [this, done](PreparedStatement &&prepared) mutable {
+                    // commands returning no rows have no row description
+                    if (!prepared.fields.empty()) {
+                        this->emit([&](Buffer &b) {
+                            put_row_description(b, prepared.fields);
                         });
-                })
-                .then([this] {
-                    return this->write(encode_bytes(ReadyForQuery{}));
-                })
-                .fail([this, id](SqlExceptionPtr e) {
-                    log::info("[session #%d] [query #%d] query execution "
-                              "failed, error = %s",
-                              _id, id, e->what());
-                })
-                .finally([this, id, timer] {
-                    auto elapsed = duration_string(timer.elapsed());
-                    log::info(
-                        "[session #%d] [query #%d] query done, elapsed = %s",
-                        _id, id, elapsed.c_str());
-                });
+                    }
+                    auto statement = std::make_shared<PreparedStatement>(
+                        std::move(prepared));
+                    return execute(statement, {}, {}, std::move(done), false);
+                },
+                false);
         } catch (SqlException &e) {
-            return reject(std::make_shared<SqlException>(std::move(e)));
+            log::info("[session #%d] [query #%d] query execution "
+                      "failed, error = %s",
+                      _id, id, e.what());
+            throw;
         }
-        break;
     }
-    case FrontendType::Terminate:
-        return reject();
+    case FrontendType::Parse:
     case FrontendType::Bind:
-    case FrontendType::Close:
-    case FrontendType::CopyFail:
     case FrontendType::Describe:
     case FrontendType::Execute:
+    case FrontendType::Close:
+        try {
+            switch (msg.type()) {
+            case FrontendType::Parse:
+                return handle_parse(static_cast<Parse &>(msg));
+            case FrontendType::Bind:
+                handle_bind(static_cast<Bind &>(msg));
+                break;
+            case FrontendType::Describe:
+                handle_describe(static_cast<Describe &>(msg));
+                break;
+            case FrontendType::Execute:
+                return handle_execute(static_cast<Execute &>(msg));
+            default:
+                handle_close(static_cast<Close &>(msg));
+                break;
+            }
+        } catch (SqlException &e) {
+            if (e.get_severity() == ErrorSeverity::Fatal) {
+                throw;
+            }
+
+            // report now, ReadyForQuery is sent once the client syncs
+            log::info("[session #%d] extended query failed, error = %s", _id,
+                      e.what());
+            send_error(e);
+            _skip_till_sync = true;
+        }
+        break;
+    case FrontendType::Sync:
+        _skip_till_sync = false;
+        return Step::Ready;
     case FrontendType::Flush:
+        return Step::Flush;
+    case FrontendType::Terminate:
+        // release the handler's resources right away, e.g. its connection
+        close_portals();
+        _statements.clear();
+        _handler.reset();
+        _async_handler.reset();
+        set_cancel_handler(nullptr);
+        return Step::Close;
+    case FrontendType::CopyFail:
     case FrontendType::FunctionCall:
-    case FrontendType::Parse:
-    case FrontendType::Sync:
     case FrontendType::GSSResponse:
     case FrontendType::SASLResponse:
     case FrontendType::SASLInitialResponse:
@@ -154,88 +361,1080 @@ Promise Session::process_message(FrontendMessagePtr msg) {
         break;
     }
 
-    return resolve();
+    return Step::Read;
 }
 
-static std::unordered_map<FrontendTag, std::function<FrontendMessage *()>>
-    sFrontendMessageRegsitry = {
-        {FrontendTag::Query, []() { return new Query; }},
-        {FrontendTag::Terminate, []() { return new Terminate; }},
+// handlers receive the parameters as text, so binary parameters of the
+// common types are converted here
+static std::string decode_parameter(std::string_view data, FormatCode format,
+                                    Oid oid) {
+    if (format == FormatCode::Text) {
+        return std::string(data);
+    }
+
+    auto bytes = reinterpret_cast<Byte const *>(data.data());
+    auto require = [&](std::size_t size) {
+        if (data.size() != size) {
+            throw SqlException{"invalid binary parameter length",
+                               SqlState::ProtocolViolation};
+        }
+    };
+
+    switch (oid) {
+    case Oid::Bool:
+        require(1);
+        return bytes[0] ? "t" : "f";
+    case Oid::Int2:
+        require(2);
+        return std::to_string(endian::network::get<int16_t>(bytes));
+    case Oid::Int4:
+        require(4);
+        return std::to_string(endian::network::get<int32_t>(bytes));
+    case Oid::Int8:
+        require(8);
+        return std::to_string(endian::network::get<int64_t>(bytes));
+    case Oid::Float4: {
+        require(4);
+        auto bits = endian::network::get<uint32_t>(bytes);
+        float v;
+        std::memcpy(&v, &bits, sizeof(v));
+        return string_format("%.9g", v);
+    }
+    case Oid::Float8: {
+        require(8);
+        auto bits = endian::network::get<uint64_t>(bytes);
+        double v;
+        std::memcpy(&v, &bits, sizeof(v));
+        return string_format("%.17g", v);
+    }
+    case Oid::Text:
+    case Oid::Varchar:
+    case Oid::Bpchar:
+    case Oid::Name:
+    case Oid::Unknown:
+        return std::string(data);
+    default:
+        break;
+    }
+
+    throw SqlException{
+        string_format("binary format for parameter type %d is not supported",
+                      int(oid)),
+        SqlState::FeatureNotSupported};
+}
+
+Session::Step Session::handle_parse(Parse const &msg) {
+    std::string name(msg.name);
+    if (!name.empty() && _statements.count(name) > 0) {
+        throw SqlException{
+            string_format("prepared statement \"%s\" already exists",
+                          name.c_str()),
+            SqlState::DuplicatePreparedStatement};
+    }
+
+    auto quoted = string_escape_space(
+        (std::stringstream() << std::quoted(msg.query)).str() //
+    );
+    log::info("[session #%d] preparing statement \"%s\" %s", _id,
+              name.c_str(), quoted.c_str());
+
+    auto then = [this, name = std::move(name),
+                 parameter_types = msg.parameter_types](
+                    PreparedStatement &&prepared) mutable {
+        auto statement =
+            std::make_shared<PreparedStatement>(std::move(prepared));
+
+        // types given by the client take precedence over the inferred ones
+        auto &types = statement->parameter_types;
+        if (types.size() < parameter_types.size()) {
+            types.resize(parameter_types.size(), Oid::Unknown);
+        }
+        for (std::size_t i = 0; i < parameter_types.size(); i++) {
+            if (parameter_types[i] != 0) {
+                types[i] = Oid(parameter_types[i]);
+            }
+        }
+
+        _statements[name] = std::move(statement);
+        this->send(kParseComplete);
+        return Step::Read;
+    };
+    // the empty query never reaches the handler, it has no command so
+    // executing it only answers with EmptyQueryResponse
+    if (is_empty_query(msg.query)) {
+        PreparedStatement empty;
+        empty.command.clear();
+        return then(std::move(empty));
+    }
+    return prepare(msg.query, std::move(then), true);
+}
+
+void Session::handle_bind(Bind const &msg) {
+    auto it = _statements.find(std::string(msg.statement));
+    if (it == _statements.end()) {
+        throw SqlException{string_format("prepared statement \"%.*s\" does "
+                                         "not exist",
+                                         int(msg.statement.size()),
+                                         msg.statement.data()),
+                           SqlState::InvalidSQLStatementName};
+    }
+
+    // the unnamed portal is replaced, a named one has to be closed first
+    std::string name(msg.portal);
+    auto existing = _portals.find(name);
+    if (existing != _portals.end()) {
+        if (!name.empty()) {
+            throw SqlException{
+                string_format("cursor \"%s\" already exists", name.c_str()),
+                SqlState::DuplicateCursor};
+        }
+        close_portal(existing->second);
+        _portals.erase(existing);
+    }
+
+    auto &statement = it->second;
+    if (msg.parameter_formats.size() > 1 &&
+        msg.parameter_formats.size() != msg.parameters.size()) {
+        throw SqlException{"parameter format codes do not match parameters",
+                           SqlState::ProtocolViolation};
+    }
+
+    if (msg.result_formats.size() > 1 &&
+        msg.result_formats.size() != statement->fields.size()) {
+        throw SqlException{"result format codes do not match columns",
+                           SqlState::ProtocolViolation};
+    }
+
+    Portal portal{statement, {}, msg.result_formats};
+    portal.parameters.reserve(msg.parameters.size());
+    for (std::size_t i = 0; i < msg.parameters.size(); i++) {
+        auto const &param = msg.parameters[i];
+        if (!param) {
+            portal.parameters.emplace_back(std::nullopt);
+            continue;
+        }
+
+        auto oid = i < statement->parameter_types.size()
+                       ? statement->parameter_types[i]
+                       : Oid::Unknown;
+        portal.parameters.emplace_back(decode_parameter(
+            *param, format_code_at(msg.parameter_formats, i), oid));
+    }
+
+    _portals[std::move(name)] = std::move(portal);
+    this->send(kBindComplete);
+}
+
+void Session::handle_describe(Describe const &msg) {
+    std::string name(msg.name);
+    if (msg.target == DescribeTarget::Statement) {
+        auto it = _statements.find(name);
+        if (it == _statements.end()) {
+            throw SqlException{
+                string_format("prepared statement \"%s\" does not exist",
+                              name.c_str()),
+                SqlState::InvalidSQLStatementName};
+        }
+
+        auto &statement = *it->second;
+        this->emit([&](Buffer &b) {
+            put_parameter_description(b, statement.parameter_types);
+        });
+        if (statement.fields.empty()) {
+            this->send(kNoData);
+        } else {
+            this->emit(
+                [&](Buffer &b) { put_row_description(b, statement.fields); });
+        }
+        return;
+    }
+
+    auto it = _portals.find(name);
+    if (it == _portals.end()) {
+        throw SqlException{
+            string_format("portal \"%s\" does not exist", name.c_str()),
+            SqlState::InvalidCursorName};
+    }
+
+    auto &portal = it->second;
+    auto &fields = portal.statement->fields;
+    if (fields.empty()) {
+        this->send(kNoData);
+    } else {
+        this->emit([&](Buffer &b) {
+            put_row_description(b, fields, portal.result_formats);
+        });
+    }
+}
+
+Session::Step Session::handle_execute(Execute const &msg) {
+    auto it = _portals.find(std::string(msg.portal));
+    if (it == _portals.end()) {
+        throw SqlException{string_format("portal \"%.*s\" does not exist",
+                                         int(msg.portal.size()),
+                                         msg.portal.data()),
+                           SqlState::InvalidCursorName};
+    }
+
+    // a portal that ran to the end before runs again
+    auto &portal = it->second;
+    if (portal.cursor && portal.cursor->finished) {
+        portal.cursor = nullptr;
+    }
+    if (portal.statement->command.empty() ||
+        (!portal.cursor && msg.max_rows <= 0)) {
+        return execute(
+            portal.statement, portal.parameters, portal.result_formats,
+            [] { return Step::Read; }, true);
+    }
+    return execute_cursor(portal, std::size_t(std::max(msg.max_rows, 0)));
+}
+
+void Session::handle_close(Close const &msg) {
+    std::string name(msg.name);
+    if (msg.target == DescribeTarget::Statement) {
+        _statements.erase(name);
+    } else if (auto it = _portals.find(name); it != _portals.end()) {
+        close_portal(it->second);
+        _portals.erase(it);
+    }
+    this->send(kCloseComplete);
+}
+
+void Session::close_portal(Portal &portal) {
+    auto cursor = std::move(portal.cursor);
+    if (!cursor || cursor->finished) {
+        return;
+    }
+
+    cursor->finished = true;
+    auto batches = std::move(cursor->batches);
+    cursor->batches.clear();
+    for (auto &batch : batches) {
+        _arena.release(std::move(batch.rows));
+        batch.written(asio::error::operation_aborted);
+    }
+    if (auto result = std::move(cursor->result)) {
+        result->cancel();
+    }
+}
+
+void Session::close_portals() {
+    for (auto &it : _portals) {
+        close_portal(it.second);
+    }
+    _portals.clear();
+}
+
+Session::Step
+Session::prepare(std::string_view query,
+                 fu2::unique_function<Step(PreparedStatement &&)> &&then,
+                 bool extended) {
+    if (!_async_handler) {
+        return then((*_handler)(query));
+    }
+
+    Completion<PreparedStatement> done{
+        executor(),
+        [this, self = shared_from_this(), then = std::move(then),
+         extended](std::optional<PreparedStatement> statement,
+                   SqlExceptionPtr error) mutable {
+            Step step;
+            try {
+                step = error ? fail(*error, extended)
+                             : then(std::move(*statement));
+            } catch (SqlException &e) {
+                step = fail(e, extended);
+            }
+            resume(step);
+        }};
+    (*_async_handler)(query, std::move(done));
+    return Step::Wait;
+}
+
+Session::Step Session::execute(PreparedStatementPtr statement,
+                               Values const &parameters,
+                               std::vector<FormatCode> const &result_formats,
+                               Next &&then, bool extended) {
+    if (statement->command.empty()) {
+        this->send(kEmptyQueryResponse);
+        return then();
+    }
+
+    if (!statement->async_handler) {
+        if (!_writing) {
+            return execute_sync(*statement, parameters, result_formats,
+                                std::move(then), extended);
+        }
+
+        // the rows are written right away, so the messages already being
+        // written go out first
+        flush([this, statement, parameters = parameters, result_formats,
+               then = std::move(then),
+               extended](io::error_code err) mutable {
+            resume(err ? Step::Close
+                       : execute_sync(*statement, parameters, result_formats,
+                                      std::move(then), extended));
+        });
+        return Step::Wait;
+    }
+
+    auto result = std::make_shared<AsyncResult>(
+        shared_from_this(), statement->fields.size(), result_formats);
+    // the statement is kept alive, its handler may still be running
+    result->_done = [this, result, statement, then = std::move(then),
+                     extended](SqlExceptionPtr error) mutable {
+        resume(complete(*statement, result->_writer, std::move(error),
+                        std::move(then), extended));
+    };
+    begin_statement();
+    statement->async_handler(result, parameters);
+    return Step::Wait;
+}
+
+Session::Step
+Session::execute_sync(PreparedStatement &statement, Values const &parameters,
+                      std::vector<FormatCode> const &result_formats,
+                      Next &&then, bool extended) {
+    // full batches of rows are written right away, so memory stays bounded
+    // whatever the result size
+    Writer writer{statement.fields.size(),
+                  [this](Bytes &data) { return write_sync(data); },
+                  io::max_buffer_size, result_formats};
+    SqlExceptionPtr error;
+    begin_statement();
+    try {
+        statement.handler(writer, parameters);
+    } catch (SqlException &e) {
+        error = std::make_shared<SqlException>(std::move(e));
+    }
+    return complete(statement, writer, std::move(error), std::move(then),
+                    extended);
+}
+
+Session::Step Session::complete(PreparedStatement const &statement,
+                                Writer const &writer, SqlExceptionPtr error,
+                                Next &&then, bool extended) {
+    auto cancelled = end_statement();
+    if (error && cancelled != Cancel::None) {
+        error = std::make_shared<SqlException>(
+            cancel_error(cancelled == Cancel::StatementTimeout));
+    }
+
+    try {
+        if (error) {
+            return fail(*error, extended);
+        }
+        this->send(writer);
+        send_command_complete(statement.command, writer.rows_affected());
+        return then();
+    } catch (SqlException &e) {
+        return fail(e, extended);
+    }
+}
+
+Session::Step Session::execute_cursor(Portal &portal, std::size_t max_rows) {
+    bool started = portal.cursor != nullptr;
+    if (!started) {
+        portal.cursor = std::make_shared<Cursor>();
+        portal.cursor->statement = portal.statement;
+    }
+    auto cursor = portal.cursor;
+    cursor->limit =
+        max_rows > 0 ? max_rows : std::numeric_limits<std::size_t>::max();
+    cursor->sent = 0;
+    begin_statement();
+    if (started) {
+        return fetch(*cursor);
+    }
+
+    auto &statement = *portal.statement;
+    if (!statement.async_handler) {
+        Writer writer{statement.fields.size(), FlushHandler{}, 0,
+                      portal.result_formats};
+        try {
+            statement.handler(writer, portal.parameters);
+        } catch (SqlException &e) {
+            cursor->error = std::make_shared<SqlException>(std::move(e));
+        }
+        cursor->completed = true;
+        cursor->rows_affected = writer.rows_affected();
+        Buffer rows{_arena.acquire()};
+        encode(rows, writer);
+        hold(*cursor, rows.take_bytes(), [](io::error_code) {});
+        return fetch(*cursor);
+    }
+
+    auto result = std::make_shared<AsyncResult>(
+        shared_from_this(), statement.fields.size(), portal.result_formats);
+    result->_cursor = cursor;
+    cursor->result = result;
+    result->_done = [this, result, cursor](SqlExceptionPtr error) {
+        // the rows below the flush threshold are left in the writer
+        Buffer rest{_arena.acquire()};
+        encode(rest, result->_writer);
+        cursor->completed = true;
+        cursor->error = std::move(error);
+        cursor->rows_affected = result->_writer.rows_affected();
+        cursor->result = nullptr;
+        hold(*cursor, rest.take_bytes(), [](io::error_code) {});
+    };
+    statement.async_handler(result, portal.parameters);
+    return fetch(*cursor);
+}
+
+// skip_rows returns the offset past at most rows DataRows of data from
+// offset on, rows is set to the number of rows skipped
+static std::size_t skip_rows(Bytes const &data, std::size_t offset,
+                             std::size_t &rows) {
+    std::size_t skipped = 0;
+    while (skipped < rows && offset < data.size()) {
+        offset += 1 + endian::network::get<uint32_t>(data.data() + offset + 1);
+        skipped++;
+    }
+    rows = skipped;
+    return offset;
+}
+
+Session::Step Session::fetch(Cursor &cursor) {
+    while (cursor.limit > 0 && !cursor.batches.empty()) {
+        auto &batch = cursor.batches.front();
+        auto rows = cursor.limit;
+        auto end = skip_rows(batch.rows, batch.offset, rows);
+        cursor.limit -= rows;
+        cursor.sent += rows;
+        if (batch.offset == 0 && end == batch.rows.size()) {
+            write_batch(std::move(batch.rows), std::move(batch.written));
+        } else {
+            // a part of the batch, the rest waits for the next Execute
+            this->emit([&](Buffer &b) {
+                b.put_bytes(batch.rows.data() + batch.offset,
+                            end - batch.offset);
+            });
+            batch.offset = end;
+            if (end < batch.rows.size()) {
+                break;
+            }
+            _arena.release(std::move(batch.rows));
+            flush(std::move(batch.written));
+        }
+        cursor.batches.pop_front();
+    }
+
+    if (!cursor.batches.empty() || (cursor.limit == 0 && !cursor.completed)) {
+        end_statement();
+        cursor.suspended = true;
+        this->send(kPortalSuspended);
+        return Step::Read;
+    }
+    if (!cursor.completed) {
+        cursor.waiting = true;
+        return Step::Wait;
+    }
+
+    cursor.finished = true;
+    auto cancelled = end_statement();
+    auto error = std::move(cursor.error);
+    if (error && cancelled != Cancel::None) {
+        error = std::make_shared<SqlException>(
+            cancel_error(cancelled == Cancel::StatementTimeout));
+    }
+    if (error) {
+        return fail(*error, true);
+    }
+    // like PostgreSQL, a portal that was suspended reports the rows of the
+    // last Execute
+    send_command_complete(cursor.statement->command,
+                          cursor.suspended ? cursor.sent
+                                           : cursor.rows_affected);
+    return Step::Read;
+}
+
+void Session::hold(Cursor &cursor, Bytes &&rows, FlushWaiter &&written) {
+    if (cursor.finished) {
+        _arena.release(std::move(rows));
+        written(asio::error::operation_aborted);
+        return;
+    }
+
+    if (rows.empty()) {
+        _arena.release(std::move(rows));
+        written(io::error_code{});
+    } else {
+        cursor.batches.push_back({std::move(rows), 0, std::move(written)});
+    }
+    if (cursor.waiting) {
+        cursor.waiting = false;
+        auto step = fetch(cursor);
+        if (step != Step::Wait) {
+            resume(step);
+        }
+    }
+}
+
+void Session::send_command_complete(std::string_view command,
+                                    std::size_t num_rows) {
+    // the commands that report the number of rows they processed, the tag
+    // of the others is the command alone
+    static constexpr std::string_view counted[] = {
+        "SELECT", "INSERT", "UPDATE", "DELETE",
+        "MERGE",  "COPY",   "FETCH",  "MOVE",
+    };
+    if (std::find(std::begin(counted), std::end(counted), command) ==
+        std::end(counted)) {
+        this->send_message(BackendTag::CommandComplete, command);
+        return;
+    }
+
+    char command_tag[16 + kMaxNumericTextSize];
+    auto n = command.size();
+    std::memcpy(command_tag, command.data(), n);
+    command_tag[n++] = ' ';
+    // INSERT reports the oid of the inserted row first, tables have no oids
+    if (command == "INSERT") {
+        command_tag[n++] = '0';
+        command_tag[n++] = ' ';
+    }
+    n += format_int8(command_tag + n, int64_t(num_rows));
+    this->send_message(BackendTag::CommandComplete,
+                       std::string_view(command_tag, n));
+}
+
+void Session::write_batch(Bytes &&b, FlushWaiter &&written) {
+    write(std::move(b));
+    _flush_waiters.push_back(std::move(written));
+    if (!_writing) {
+        do_flush();
+    }
+}
+
+bool Session::write_sync(Bytes const &b) {
+    _inflight_buffers.clear();
+    for (auto const &bytes : _pending) {
+        _inflight_buffers.push_back(asio::buffer(bytes));
+    }
+    _inflight_buffers.push_back(asio::buffer(b));
+
+    io::error_code err;
+    asio::write(_socket, _inflight_buffers, err);
+    for (auto &bytes : _pending) {
+        _arena.release(std::move(bytes));
+    }
+    _pending.clear();
+    _pending_size = 0;
+
+    if (err) {
+        log::error("[session #%d] write failed: %s", _id,
+                   err.message().c_str());
+    }
+    return !err;
+}
+
+AsyncResult::AsyncResult(SessionPtr session, std::size_t num_cols,
+                         std::vector<FormatCode> const &format_codes)
+    : _session(std::move(session)),
+      _writer(
+          num_cols, [this](Bytes &data) { return send_batch(data); },
+          io::max_buffer_size, format_codes) {}
+
+Writer &AsyncResult::writer() { return _writer; }
+
+void AsyncResult::finish() { complete(nullptr); }
+
+void AsyncResult::fail(SqlException error) {
+    complete(std::make_shared<SqlException>(std::move(error)));
+}
+
+bool AsyncResult::cancelled() const {
+    std::lock_guard lock{_mutex};
+    return _cancelled;
+}
+
+bool AsyncResult::interrupted() const {
+    std::lock_guard lock{_session->_cancel_mutex};
+    return _session->_cancelled != Session::Cancel::None;
+}
+
+bool AsyncResult::writable() const {
+    std::lock_guard lock{_mutex};
+    return _queued < kMaxQueuedBatches || _cancelled;
+}
+
+void AsyncResult::on_writable(fu2::unique_function<void()> &&callback) {
+    {
+        std::lock_guard lock{_mutex};
+        if (_queued >= kMaxQueuedBatches && !_cancelled) {
+            _on_writable = std::move(callback);
+            return;
+        }
+    }
+    callback();
+}
+
+bool AsyncResult::send_batch(Bytes &data) {
+    Bytes spare;
+    {
+        std::lock_guard lock{_mutex};
+        if (_cancelled) {
+            return false;
+        }
+        _queued++;
+        if (!_spare.empty()) {
+            spare = std::move(_spare.back());
+            _spare.pop_back();
+        }
+    }
+
+    // the rows are moved out, the writer goes on in a spare chunk
+    auto batch = std::move(data);
+    data = std::move(spare);
+    asio::post(_session->executor(),
+               [self = shared_from_this(), batch = std::move(batch)]() mutable {
+                   // the batch goes to the session's arena once written, so
+                   // a chunk as big is acquired from it in exchange and
+                   // handed to the producer for a later batch
+                   auto chunk =
+                       self->_session->_arena.acquire(batch.capacity());
+                   {
+                       std::lock_guard lock{self->_mutex};
+                       self->_spare.push_back(std::move(chunk));
+                   }
+                   auto written = [self](io::error_code err) {
+                       fu2::unique_function<void()> on_writable;
+                       {
+                           std::lock_guard lock{self->_mutex};
+                           self->_queued--;
+                           self->_cancelled = self->_cancelled || bool(err);
+                           std::swap(on_writable, self->_on_writable);
+                       }
+                       if (on_writable) {
+                           on_writable();
+                       }
+                   };
+                   if (self->_cursor) {
+                       self->_session->hold(*self->_cursor, std::move(batch),
+                                            std::move(written));
+                   } else {
+                       self->_session->write_batch(std::move(batch),
+                                                   std::move(written));
+                   }
+               });
+    return true;
+}
+
+void AsyncResult::cancel() {
+    fu2::unique_function<void()> on_writable;
+    {
+        std::lock_guard lock{_mutex};
+        _cancelled = true;
+        std::swap(on_writable, _on_writable);
+    }
+    if (on_writable) {
+        on_writable();
+    }
+}
+
+void AsyncResult::complete(SqlExceptionPtr error) {
+    if (_completed.exchange(true)) {
+        return;
+    }
+
+    // posted after the batches, so the rows are queued before the rest
+    asio::post(_session->executor(),
+               [self = shared_from_this(), error = std::move(error)] {
+                   // moved out to break the cycle between the result and
+                   // its continuation
+                   auto done = std::move(self->_done);
+                   self->_done = nullptr;
+                   if (done) {
+                       done(error);
+                   }
+               });
+}
+
+using MessageFactory = FrontendMessagePtr (*)();
+
+template <typename T> static FrontendMessagePtr make_message() {
+    return std::make_shared<T>();
+}
+
+// frontend messages by slot, the session keeps one message per slot and
+// decodes into it again once nothing refers to it anymore
+static constexpr MessageFactory sMessageFactories[] = {
+    nullptr, // unknown tag
+    make_message<Query>,    make_message<Parse>,   make_message<Bind>,
+    make_message<Describe>, make_message<Execute>, make_message<Close>,
+    make_message<Sync>,     make_message<Flush>,   make_message<Terminate>,
 };
+static_assert(std::size(sMessageFactories) <= Session::kMessageSlots);
+
+static constexpr auto sMessageSlots = [] {
+    std::array<uint8_t, 256> slots{};
+    FrontendTag tags[] = {FrontendTag::Query,    FrontendTag::Parse,
+                          FrontendTag::Bind,     FrontendTag::Describe,
+                          FrontendTag::Execute,  FrontendTag::Close,
+                          FrontendTag::Sync,     FrontendTag::Flush,
+                          FrontendTag::Terminate};
+    for (std::size_t i = 0; i < std::size(tags); i++) {
+        slots[uint8_t(tags[i])] = uint8_t(i + 1);
+    }
+    return slots;
+}();
 
 Promise Session::read() {
-    // std::cerr << "reading startup=" << _startup_done << std::endl;
-    if (!_startup_done) {
-        return read_startup();
-    }
-
-    constexpr auto kHeaderSize = sizeof(MessageTag) + sizeof(int32_t);
-    auto header = std::make_shared<Bytes>(kHeaderSize);
-    auto body = std::make_shared<Bytes>();
-
-    return io::async_read_exact(_socket, asio::buffer(*header))
-        .then([=] {
-            Buffer headerBuffer(std::move(*header));
-            MessageTag tag = headerBuffer.get_numeric<MessageTag>();
-            int32_t len = headerBuffer.get_numeric<int32_t>();
-            std::size_t size =
-                len - sizeof(int32_t); // to exclude it self length
-
-            return resolve(tag, size);
-        })
-        .then([=](MessageTag tag, std::size_t size) {
-            body->resize(size);
-            return io::async_read_exact(_socket, asio::buffer(*body)).then([=] {
-                auto it = sFrontendMessageRegsitry.find(FrontendTag(tag));
-                if (it == sFrontendMessageRegsitry.end()) {
-                    return resolve(FrontendMessagePtr(nullptr));
-                }
+    FrontendMessagePtr message;
+    try {
+        // pipelined messages are served from the buffer without touching the
+        // socket
+        if (decode(message)) {
+            return resolve(message);
+        }
+    } catch (SqlException &e) {
+        return reject(std::make_shared<SqlException>(std::move(e)));
+    }
 
-                Buffer buff(std::move(*body));
-                auto fn = it->second;
-                auto message = FrontendMessagePtr(fn());
-                message->decode(buff);
+    return receive().then([this] { return read(); });
+}
+
+Promise Session::receive() {
+    prepare_receive();
+    return newPromise([this](Defer &defer) {
+        _socket.async_read_some(
+            asio::buffer(_recv->data() + _recv_end, _recv->size() - _recv_end),
+            [this, defer, self = shared_from_this()](io::error_code err,
+                                                     std::size_t len) {
+                if (err) {
+                    defer.reject(err);
+                    return;
+                }
 
-                return resolve(message);
+                _recv_end += len;
+                defer.resolve();
             });
-        });
+    });
+}
+
+void Session::prepare_receive() {
+    // ensure there is enough room after the unread bytes for the rest of the
+    // incomplete message
+    std::size_t unread = _recv_end - _recv_begin;
+    std::size_t required = std::max(_recv_needed, unread + kMinReceiveSize);
+    if (!_recv || _recv->size() - _recv_begin < required) {
+        std::size_t capacity =
+            std::max({required, kReceiveBufferSize, _recv ? _recv->size() : 0});
+        // idle cached messages don't hold the buffer
+        for (auto &cached : _messages) {
+            if (cached && cached.use_count() == 1) {
+                cached->storage.reset();
+            }
+        }
+        if (_recv && _recv.use_count() == 1 && _recv->size() >= capacity) {
+            // no decoded message refers to it anymore, compact in place
+            std::memmove(_recv->data(), _recv->data() + _recv_begin, unread);
+        } else {
+            auto chunk = std::make_shared<Bytes>(_arena.acquire(capacity));
+            chunk->resize(capacity);
+            if (unread > 0) {
+                std::memcpy(chunk->data(), _recv->data() + _recv_begin, unread);
+            }
+            // recycle the previous chunk unless a decoded message holds it,
+            // it is left to the last message then
+            if (_recv) {
+                _arena.release(_recv.use_count() == 1 ? std::move(*_recv)
+                                                      : Bytes{});
+            }
+            _recv = std::move(chunk);
+        }
+
+        _recv_begin = 0;
+        _recv_end = unread;
+    }
+
+    _stats.read_calls++;
+}
+
+bool Session::decode(FrontendMessagePtr &message) {
+    // startup packet has no tag, only the length
+    std::size_t header_size =
+        _startup_done ? sizeof(MessageTag) + sizeof(int32_t) : sizeof(int32_t);
+    std::size_t available = _recv_end - _recv_begin;
+    if (available < header_size) {
+        _recv_needed = 0;
+        return false;
+    }
+
+    Byte const *data = _recv->data() + _recv_begin;
+    MessageTag tag = _startup_done ? data[0] : 0;
+    int32_t len = endian::network::get<int32_t>(data + header_size -
+                                                sizeof(int32_t));
+    if (len < int32_t(sizeof(int32_t))) {
+        throw SqlException{"invalid message length",
+                           SqlState::ProtocolViolation, ErrorSeverity::Fatal};
+    }
+
+    std::size_t total = header_size + len - sizeof(int32_t);
+    if (available < total) {
+        _recv_needed = total;
+        return false;
+    }
+
+    // the message refers to the receive buffer instead of copying its body
+    BufferView body{data + header_size, total - header_size};
+    _recv_begin += total;
+    _recv_needed = 0;
+    _stats.messages_decoded++;
+
+    if (!_startup_done) {
+        auto msg = std::make_shared<StartupMessage>();
+        msg->storage = _recv;
+        msg->decode(body);
+
+        if (!msg->is_ssl_request)
+            _startup_done = true;
+
+        message = msg;
+        return true;
+    }
+
+    auto slot = sMessageSlots[tag];
+    if (slot == 0) {
+        message = nullptr;
+        return true;
+    }
+
+    // reuse the previous message of the type unless it is still held
+    auto &cached = _messages[slot];
+    if (!cached || cached.use_count() > 1) {
+        cached = sMessageFactories[slot]();
+    }
+    cached->storage = _recv;
+    cached->decode(body);
+    message = cached;
+    return true;
+}
+
+void Session::send_error(SqlException const &e) {
+    send_message(BackendTag::ErrorResponse, Byte('S'),
+                 get_error_severity(e.get_severity()), Byte('C'),
+                 get_sqlstate_code(e.get_sqlstate()), Byte('M'),
+                 e.get_message(), Byte(0));
 }
-Promise Session::read_startup() {
-    auto lenBuf = std::make_shared<int32_t>(0);
-    auto bytes = std::make_shared<Bytes>();
-    return io::async_read_exact(
-               _socket, asio::buffer(reinterpret_cast<uint8_t *>(lenBuf.get()),
-                                     sizeof(int32_t)))
-        .then([lenBuf] {
-            int32_t len = endian::network::get<int32_t>(
-                reinterpret_cast<uint8_t *>(lenBuf.get()));
-            std::size_t size =
-                len - sizeof(int32_t); // to exclude it self length
-            return resolve(size);
-        })
-        .then([=](std::size_t size) {
-            bytes->resize(size);
-            return io::async_read_exact(_socket, asio::buffer(*bytes))
-                .then([=]() {
-                    Buffer buf{std::move(*bytes)};
-                    auto msg = std::make_shared<StartupMessage>();
-                    msg->decode(buf);
-
-                    if (!msg->is_ssl_request)
-                        _startup_done = true;
-
-                    return resolve(FrontendMessagePtr(msg));
-                });
+
+Promise Session::ready() {
+    return newPromise([this](Defer &defer) {
+        ready([defer](io::error_code err) {
+            if (err) {
+                defer.reject(err);
+            } else {
+                defer.resolve();
+            }
         });
+    });
+}
+
+void Session::ready(FlushWaiter &&done) {
+    send(ready_for_query(_transaction_status));
+    flush([this, done = std::move(done)](io::error_code err) mutable {
+        if (!err) {
+            _arena.reset();
+        }
+        done(err);
+    });
+}
+
+void Session::write(Bytes &&b) {
+    _pending_size += b.size();
+    _pending.push_back(std::move(b));
+
+    // uncork when a lot of data is waiting, without waiting for the flush
+    if (_pending_size >= kCorkThreshold && !_writing) {
+        do_flush();
+    }
 }
 
-Promise Session::write(Bytes &&b) {
-    // use shared_buffer to extend the lifetime of bytes
-    // since it can outlive this function
-    auto shared = std::make_shared<Bytes>(std::move(b));
-    return io::async_write(_socket, asio::buffer(*shared)).finally([shared]() {
-        // ensure the shared bytes is destroyed at the end
+Promise Session::flush() {
+    return newPromise([this](Defer &defer) {
+        flush([defer](io::error_code err) {
+            if (err) {
+                defer.reject(err);
+            } else {
+                defer.resolve();
+            }
+        });
     });
 }
 
+void Session::flush(FlushWaiter &&written) {
+    _flush_waiters.push_back(std::move(written));
+    if (!_writing) {
+        do_flush();
+    }
+}
+
+void Session::do_flush() {
+    if (_pending.empty()) {
+        // nothing left to write, every waiter is already satisfied
+        auto waiters = std::move(_flush_waiters);
+        _flush_waiters.clear();
+        for (auto &waiter : waiters) {
+            waiter(io::error_code{});
+        }
+        return;
+    }
+
+    _writing = true;
+    std::swap(_inflight, _pending);
+    std::swap(_inflight_waiters, _flush_waiters);
+    _pending_size = 0;
+
+    _inflight_buffers.clear();
+    for (auto const &bytes : _inflight) {
+        _inflight_buffers.push_back(asio::buffer(bytes));
+    }
+
+    // the buffers are owned by the session, keep it alive until the write is
+    // completed
+    asio::async_write(
+        _socket, _inflight_buffers,
+        [this, self = shared_from_this()](io::error_code err, std::size_t) {
+            _writing = false;
+            for (auto &bytes : _inflight) {
+                _arena.release(std::move(bytes));
+            }
+            _inflight.clear();
+
+            auto waiters = std::move(_inflight_waiters);
+            _inflight_waiters.clear();
+            for (auto &waiter : waiters) {
+                waiter(err);
+            }
+
+            if (err) {
+                log::error("[session #%d] write failed: %s", _id,
+                           err.message().c_str());
+                // nothing queued meanwhile can be sent anymore, its waiters
+                // fail too so the session can wind down
+                for (auto &bytes : _pending) {
+                    _arena.release(std::move(bytes));
+                }
+                _pending.clear();
+                _pending_size = 0;
+
+                auto queued = std::move(_flush_waiters);
+                _flush_waiters.clear();
+                for (auto &waiter : queued) {
+                    waiter(err);
+                }
+                return;
+            }
+
+            // a waiter may have resumed the session, which may be writing
+            // again already
+            if (!_writing && (!_pending.empty() || !_flush_waiters.empty())) {
+                do_flush();
+            }
+        });
+}
+
+#ifdef PGWIRE_USE_COROUTINES
+// the coroutine flavor of the session loop, the messages are handled the
+// same way but every wait is a co_await instead of a promise chain
+asio::awaitable<void> Session::run() {
+    auto self = shared_from_this();
+    for (;;) {
+        FrontendMessagePtr message;
+        try {
+            while (!decode(message)) {
+                if (!co_await co_receive()) {
+                    co_return;
+                }
+            }
+        } catch (SqlException &e) {
+            log::info("[session #%d] invalid message, error = %s", _id,
+                      e.what());
+            co_return;
+        }
+        if (!message) {
+            continue;
+        }
+
+        Step step;
+        try {
+            step = handle(*message);
+        } catch (SqlException &e) {
+            if (e.get_severity() == ErrorSeverity::Fatal) {
+                co_return;
+            }
+            send_error(e);
+            step = Step::Ready;
+        }
+        // let the next message of the type reuse it
+        message.reset();
+        while (step == Step::Wait) {
+            step = co_await co_resume();
+        }
+
+        switch (step) {
+        case Step::Read:
+            break;
+        case Step::Flush:
+            if (!co_await co_flush()) {
+                co_return;
+            }
+            break;
+        case Step::Ready:
+            if (!co_await co_ready()) {
+                co_return;
+            }
+            break;
+        case Step::Close:
+        case Step::Wait:
+            co_return;
+        }
+    }
+}
+
+asio::awaitable<bool> Session::co_receive() {
+    prepare_receive();
+
+    io::error_code err;
+    auto len = co_await _socket.async_read_some(
+        asio::buffer(_recv->data() + _recv_end, _recv->size() - _recv_end),
+        asio::redirect_error(asio::use_awaitable, err));
+    if (err) {
+        co_return false;
+    }
+
+    _recv_end += len;
+    co_return true;
+}
+
+asio::awaitable<Session::Step> Session::co_resume() {
+    auto token = asio::use_awaitable;
+    co_return co_await asio::async_initiate<decltype(token), void(Step)>(
+        [this](auto handler) { _resume = std::move(handler); }, token);
+}
+
+asio::awaitable<bool> Session::co_flush() {
+    if (_pending.empty() && !_writing) {
+        co_return true;
+    }
+
+    // waits with the promise based flushes, the writes stay in order
+    io::error_code err;
+    auto token = asio::redirect_error(asio::use_awaitable, err);
+    co_await asio::async_initiate<decltype(token), void(io::error_code)>(
+        [this](auto handler) { flush(std::move(handler)); }, token);
+    co_return !err;
+}
+
+asio::awaitable<bool> Session::co_ready() {
+    io::error_code err;
+    auto token = asio::redirect_error(asio::use_awaitable, err);
+    co_await asio::async_initiate<decltype(token), void(io::error_code)>(
+        [this](auto handler) { ready(std::move(handler)); }, token);
+    co_return !err;
+}
+#endif
+
 } // namespace pgwire
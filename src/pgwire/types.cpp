@@ -329,6 +329,14 @@ char const *get_sqlstate_code(SqlState state) {
         return "42601";
     case SqlState::InvalidDatetimeFormat:
         return "22007";
+    case SqlState::DuplicatePreparedStatement:
+        return "42P05";
+    case SqlState::QueryCanceled:
+        return "57014";
+    case SqlState::InvalidParameterValue:
+        return "22023";
+    case SqlState::DuplicateCursor:
+        return "42P03";
     }
 
     return "";
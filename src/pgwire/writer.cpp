@@ -1,26 +1,33 @@
 #include "pgwire/types.hpp"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <strings.h>
+
+#include <pgwire/format.hpp>
 #include <pgwire/protocol.hpp>
 #include <pgwire/writer.hpp>
 
 namespace pgwire {
 
-template <typename T>
-std::enable_if_t<std::is_integral_v<T> || std::is_floating_point_v<T>>
-write_numeric(Buffer &buffer, FormatCode format_code, T value,
-              const char *format) {
-    switch (format_code) {
-    case FormatCode::Binary:
-        buffer.put_numeric<int32_t>(sizeof(T));
-        buffer.put_numeric<T>(value);
-        break;
-    case FormatCode::Text: {
-        char buf[256];
-        auto len = sprintf(buf, format, value);
-        buffer.put_numeric<int32_t>(len);
-        buffer.put_bytes(reinterpret_cast<Byte const *>(buf), len);
-        break;
-    }
-    }
+// offsets between the unix epoch and the postgres epoch (2000-01-01)
+constexpr int32_t kEpochDays = 10957;
+constexpr int64_t kEpochMicros = int64_t(kEpochDays) * 86400 * 1000000;
+
+static std::size_t format_text(char *out, int16_t v) {
+    return format_int2(out, v);
+}
+static std::size_t format_text(char *out, int32_t v) {
+    return format_int4(out, v);
+}
+static std::size_t format_text(char *out, int64_t v) {
+    return format_int8(out, v);
+}
+static std::size_t format_text(char *out, float v) {
+    return format_float4(out, v);
+}
+static std::size_t format_text(char *out, double v) {
+    return format_float8(out, v);
 }
 
 void encode(Buffer &b, Writer const &writer) {
@@ -28,33 +35,170 @@ void encode(Buffer &b, Writer const &writer) {
 }
 
 Writer::Writer(std::size_t num_cols, FormatCode format_code)
-    : _format_code(format_code), _num_cols(num_cols) {}
+    : _format_codes(num_cols, format_code), _num_cols(num_cols) {}
+
+Writer::Writer(std::size_t num_cols, FlushHandler &&on_flush,
+               std::size_t flush_threshold,
+               std::vector<FormatCode> const &format_codes)
+    : _num_cols(num_cols), _on_flush(std::move(on_flush)),
+      _flush_threshold(flush_threshold) {
+    _format_codes.reserve(num_cols);
+    for (std::size_t i = 0; i < num_cols; i++) {
+        _format_codes.push_back(format_code_at(format_codes, i));
+    }
+}
 
 RowWriter Writer::add_row() {
-    RowWriter rowWriter{*this};
     _num_rows++;
-    return rowWriter;
+    // guaranteed copy elision, the row is only finished once
+    return RowWriter{*this};
 }
 
 std::size_t Writer::num_rows() const { return _num_rows; }
 
-RowWriter::RowWriter(Writer &writer) : _writer(writer) {}
-RowWriter::~RowWriter() {
+void Writer::set_rows_affected(std::size_t rows) { _rows_affected = rows; }
+
+std::size_t Writer::rows_affected() const {
+    return _rows_affected.value_or(_num_rows);
+}
+
+FormatCode Writer::format_code(std::size_t col) const {
+    return col < _format_codes.size() ? _format_codes[col] : FormatCode::Text;
+}
+
+bool Writer::flush() {
+    if (!_on_flush || _data.size() < _flush_threshold) {
+        return !_failed;
+    }
+
+    auto data = _data.take_bytes();
+    _failed = _failed || !_on_flush(data);
+    // keep the capacity, the next batch is going to be as big
+    data.clear();
+    _data = Buffer{std::move(data)};
+    return !_failed;
+}
+
+// the values are written in place after the DataRow header, the length and
+// the number of columns are filled in when the row is done
+RowWriter::RowWriter(Writer &writer)
+    : _writer(writer), _start(writer._data.data().size()) {
     _writer._data.put_numeric<int8_t>(int8_t(BackendTag::DataRow));
-    _writer._data.put_numeric<int32_t>(_row.size() + 6);
-    _writer._data.put_numeric<int16_t>(_current_col);
-    _writer._data.put_bytes(_row.data());
+    _writer._data.put_numeric<int32_t>(0);
+    _writer._data.put_numeric<int16_t>(0);
+}
+
+RowWriter::~RowWriter() {
+    auto &data = _writer._data;
+    data.set_numeric<int32_t>(_start + 1,
+                              int32_t(data.data().size() - _start - 1));
+    data.set_numeric<int16_t>(_start + 5, int16_t(_current_col));
+    _writer.flush();
+}
+
+Buffer &RowWriter::output() {
+    return _depth == 0 ? _writer._data : _writer._nested[_depth - 1].data;
+}
+
+void RowWriter::advance() {
+    if (_depth == 0) {
+        _current_col++;
+    } else {
+        _writer._nested[_depth - 1].count++;
+    }
+}
+
+// text elements of arrays and records are quoted when they contain one of
+// the delimiters or whitespace, like postgres' array_out and record_out
+static bool needs_quote(Byte const *b, std::size_t size, NestedKind kind) {
+    if (size == 0) {
+        return true;
+    }
+    if (kind == NestedKind::Array && size == 4 &&
+        strncasecmp(reinterpret_cast<char const *>(b), "NULL", 4) == 0) {
+        return true;
+    }
+
+    for (std::size_t i = 0; i < size; i++) {
+        switch (b[i]) {
+        case '"':
+        case '\\':
+        case ',':
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+        case '\v':
+        case '\f':
+            return true;
+        case '{':
+        case '}':
+            if (kind == NestedKind::Array) {
+                return true;
+            }
+            break;
+        case '(':
+        case ')':
+            if (kind == NestedKind::Record) {
+                return true;
+            }
+            break;
+        }
+    }
+    return false;
 }
 
 void RowWriter::write_value(Byte const *b, std::size_t size) {
-    _current_col++;
-    _row.put_numeric<int32_t>(size);
-    _row.put_bytes(b, size);
+    if (_depth == 0 || format_code() == FormatCode::Binary) {
+        auto &out = output();
+        out.put_numeric<int32_t>(size);
+        out.put_bytes(b, size);
+        advance();
+        return;
+    }
+
+    auto &nested = _writer._nested[_depth - 1];
+    if (nested.count > 0) {
+        nested.data.put_byte(',');
+    }
+    if (!needs_quote(b, size, nested.kind)) {
+        nested.data.put_bytes(b, size);
+        nested.count++;
+        return;
+    }
+
+    // arrays escape with a backslash, records double the char
+    nested.data.put_byte('"');
+    for (std::size_t i = 0; i < size; i++) {
+        if (b[i] == '"' || b[i] == '\\') {
+            nested.data.put_byte(nested.kind == NestedKind::Array ? '\\'
+                                                                  : b[i]);
+        }
+        nested.data.put_byte(b[i]);
+    }
+    nested.data.put_byte('"');
+    nested.count++;
 }
 
 void RowWriter::write_null() {
-    _current_col++;
-    _row.put_numeric<int32_t>(-1);
+    if (_depth == 0 || format_code() == FormatCode::Binary) {
+        output().put_numeric<int32_t>(-1);
+        if (_depth > 0) {
+            _writer._nested[_depth - 1].has_null = true;
+        }
+        advance();
+        return;
+    }
+
+    // NULL in arrays, nothing at all in records
+    auto &nested = _writer._nested[_depth - 1];
+    if (nested.count > 0) {
+        nested.data.put_byte(',');
+    }
+    if (nested.kind == NestedKind::Array) {
+        nested.data.put_bytes(reinterpret_cast<Byte const *>("NULL"), 4);
+    }
+    nested.count++;
 }
 
 void RowWriter::write_string(std::string const &value) {
@@ -65,43 +209,248 @@ void RowWriter::write_cstring(const char *v) {
     write_value(reinterpret_cast<Byte const *>(v), strlen(v));
 }
 
+FormatCode RowWriter::format_code() const {
+    return _writer.format_code(_current_col);
+}
+
+Bytes const &RowWriter::encoded() const { return _writer._data.data(); }
+
+void RowWriter::write_encoded(Byte const *b, std::size_t size) {
+    _writer._data.put_bytes(b, size);
+    _current_col++;
+}
+
+void RowWriter::begin_nested(NestedKind kind, Oid element_oid) {
+    if (_writer._nested.size() <= _depth) {
+        _writer._nested.emplace_back();
+    }
+
+    auto &nested = _writer._nested[_depth++];
+    nested.kind = kind;
+    nested.element_oid = element_oid;
+    nested.count = 0;
+    nested.has_null = false;
+    nested.data.clear();
+
+    if (format_code() == FormatCode::Text) {
+        nested.data.put_byte(kind == NestedKind::Array ? '{' : '(');
+    }
+}
+
+void RowWriter::end_nested() {
+    auto &nested = _writer._nested[--_depth];
+
+    if (format_code() == FormatCode::Text) {
+        nested.data.put_byte(nested.kind == NestedKind::Array ? '}' : ')');
+        // the nested value is an element of its parent now
+        auto const &data = nested.data.data();
+        write_value(data.data(), data.size());
+        return;
+    }
+
+    auto &out = output();
+    if (nested.kind == NestedKind::Record) {
+        // number of fields, every field is preceded by its oid
+        out.put_numeric<int32_t>(4 + nested.data.size());
+        out.put_numeric<int32_t>(nested.count);
+    } else if (nested.count == 0) {
+        // an empty array has no dimension
+        out.put_numeric<int32_t>(12);
+        out.put_numeric<int32_t>(0);
+        out.put_numeric<int32_t>(0);
+        out.put_numeric<int32_t>(int32_t(nested.element_oid));
+    } else {
+        // a single dimension starting at 1
+        out.put_numeric<int32_t>(20 + nested.data.size());
+        out.put_numeric<int32_t>(1);
+        out.put_numeric<int32_t>(nested.has_null ? 1 : 0);
+        out.put_numeric<int32_t>(int32_t(nested.element_oid));
+        out.put_numeric<int32_t>(nested.count);
+        out.put_numeric<int32_t>(1);
+    }
+    out.put_bytes(nested.data.data());
+    advance();
+}
+
+void RowWriter::begin_array(Oid element_oid) {
+    begin_nested(NestedKind::Array, element_oid);
+}
+
+void RowWriter::end_array() { end_nested(); }
+
+void RowWriter::begin_record() {
+    begin_nested(NestedKind::Record, Oid::Record);
+}
+
+void RowWriter::record_field(Oid oid) {
+    if (format_code() == FormatCode::Binary) {
+        _writer._nested[_depth - 1].data.put_numeric<int32_t>(int32_t(oid));
+    }
+}
+
+void RowWriter::end_record() { end_nested(); }
+
+template <typename T> void RowWriter::write_number(T v) {
+    if (format_code() == FormatCode::Binary) {
+        // floats are sent as their IEEE 754 bits in network order
+        using Bits = std::conditional_t<
+            std::is_floating_point_v<T>,
+            std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>, T>;
+        Bits bits;
+        std::memcpy(&bits, &v, sizeof(T));
+
+        auto &out = output();
+        out.put_numeric<int32_t>(sizeof(T));
+        out.put_numeric<Bits>(bits);
+        advance();
+        return;
+    }
+
+    if (_depth == 0) {
+        // formatted in place, the unused room is dropped afterwards
+        auto &out = output();
+        auto start = out.data().size();
+        auto p = out.extend(sizeof(int32_t) + kMaxNumericTextSize);
+        auto n = format_text(reinterpret_cast<char *>(p + sizeof(int32_t)), v);
+        endian::network::put<int32_t>(int32_t(n), p);
+        out.truncate(start + sizeof(int32_t) + n);
+        advance();
+        return;
+    }
+
+    char buf[kMaxNumericTextSize];
+    write_value(reinterpret_cast<Byte *>(buf), format_text(buf, v));
+}
+
 void RowWriter::write_bool(bool v) {
-    switch (_writer._format_code) {
-    case FormatCode::Text:
-        if (v) {
-            write_cstring("t");
-        } else {
-            write_cstring("f");
+    Byte b;
+    if (format_code() == FormatCode::Binary) {
+        b = v ? 1 : 0;
+    } else {
+        b = v ? 't' : 'f';
+    }
+    write_value(&b, sizeof(b));
+}
+
+void RowWriter::write_int2(int16_t v) { write_number(v); }
+void RowWriter::write_int4(int32_t v) { write_number(v); }
+void RowWriter::write_int8(int64_t v) { write_number(v); }
+void RowWriter::write_float4(float v) { write_number(v); }
+void RowWriter::write_float8(double v) { write_number(v); }
+
+void RowWriter::write_date(int32_t days) {
+    if (format_code() == FormatCode::Binary) {
+        // postgres sends the infinities as the int max and min, DuckDB's
+        // -infinity is the negated max and must not be shifted
+        if (days == -std::numeric_limits<int32_t>::max()) {
+            days = std::numeric_limits<int32_t>::min();
+        } else if (days != std::numeric_limits<int32_t>::max()) {
+            days -= kEpochDays;
         }
+        write_number(days);
+        return;
+    }
 
-        break;
-    case FormatCode::Binary:
-        _current_col++;
-        write_numeric(_row, FormatCode::Binary, v, nullptr);
+    char buf[kMaxTemporalTextSize];
+    write_value(reinterpret_cast<Byte *>(buf), format_date(buf, days));
+}
 
-        break;
+void RowWriter::write_time(int64_t micros) {
+    if (format_code() == FormatCode::Binary) {
+        write_number(micros);
+        return;
     }
+
+    char buf[kMaxTemporalTextSize];
+    write_value(reinterpret_cast<Byte *>(buf), format_time(buf, micros));
 }
 
-void RowWriter::write_int2(int16_t v) {
-    _current_col++;
-    write_numeric(_row, _writer._format_code, v, "%d");
+void RowWriter::write_timestamp(int64_t micros) {
+    if (format_code() == FormatCode::Binary) {
+        if (micros == -std::numeric_limits<int64_t>::max()) {
+            micros = std::numeric_limits<int64_t>::min();
+        } else if (micros != std::numeric_limits<int64_t>::max()) {
+            micros -= kEpochMicros;
+        }
+        write_number(micros);
+        return;
+    }
+
+    char buf[kMaxTemporalTextSize];
+    write_value(reinterpret_cast<Byte *>(buf), format_timestamp(buf, micros));
 }
-void RowWriter::write_int4(int32_t v) {
-    _current_col++;
-    write_numeric(_row, _writer._format_code, v, "%d");
+
+void RowWriter::write_timestamptz(int64_t micros) {
+    if (format_code() == FormatCode::Binary) {
+        write_timestamp(micros);
+        return;
+    }
+
+    char buf[kMaxTemporalTextSize];
+    write_value(reinterpret_cast<Byte *>(buf),
+                format_timestamptz(buf, micros));
 }
-void RowWriter::write_int8(int64_t v) {
-    _current_col++;
-    write_numeric(_row, _writer._format_code, v, "%lld");
+
+void RowWriter::write_interval(int32_t months, int32_t days, int64_t micros) {
+    if (format_code() == FormatCode::Binary) {
+        Byte buf[16];
+        endian::network::put<int64_t>(micros, buf);
+        endian::network::put<int32_t>(days, buf + 8);
+        endian::network::put<int32_t>(months, buf + 12);
+        write_value(buf, sizeof(buf));
+        return;
+    }
+
+    char buf[kMaxTemporalTextSize];
+    write_value(reinterpret_cast<Byte *>(buf),
+                format_interval(buf, months, days, micros));
 }
-void RowWriter::write_float4(float v) {
-    _current_col++;
-    write_numeric(_row, _writer._format_code, v, "%f");
+
+void RowWriter::write_decimal(Int128 v, uint8_t scale) {
+    if (format_code() == FormatCode::Binary) {
+        Byte buf[kMaxDecimalBinarySize];
+        write_value(buf, encode_decimal(buf, v, scale));
+        return;
+    }
+
+    char buf[kMaxDecimalTextSize];
+    write_value(reinterpret_cast<Byte *>(buf), format_decimal(buf, v, scale));
+}
+
+void RowWriter::write_uuid(Byte const *bytes) {
+    if (format_code() == FormatCode::Binary) {
+        write_value(bytes, 16);
+        return;
+    }
+
+    char buf[kUuidTextSize];
+    write_value(reinterpret_cast<Byte *>(buf), format_uuid(buf, bytes));
 }
-void RowWriter::write_float8(double v) {
+
+void RowWriter::write_bytea(Byte const *data, std::size_t size) {
+    if (format_code() == FormatCode::Binary) {
+        write_value(data, size);
+        return;
+    }
+
+    if (_depth > 0) {
+        // elements need quoting, so the text is built upfront
+        std::string text(2 + size * 2, '\\');
+        text[1] = 'x';
+        format_hex(text.data() + 2, data, size);
+        write_string(text);
+        return;
+    }
+
+    // hex format, i.e. \x followed by two digits per byte, encoded straight
+    // into the row
+    auto &out = output();
+    out.put_numeric<int32_t>(2 + size * 2);
+    auto p = reinterpret_cast<char *>(out.extend(2 + size * 2));
+    p[0] = '\\';
+    p[1] = 'x';
+    format_hex(p + 2, data, size);
     _current_col++;
-    write_numeric(_row, _writer._format_code, v, "%f");
 }
 
-} // namespace pgwire
\ No newline at end of file
+} // namespace pgwire
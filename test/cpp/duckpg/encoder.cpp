@@ -0,0 +1,183 @@
+#include <catch2/catch.hpp>
+
+#include <string>
+#include <vector>
+
+#include <duckdb.hpp>
+#include <duckpg/encoder.hpp>
+#include <pgwire/buffer.hpp>
+#include <pgwire/utils.hpp>
+#include <pgwire/writer.hpp>
+
+using namespace duckdb;
+using pgwire::FormatCode;
+using pgwire::Oid;
+
+// the oids of a query's columns and its rows as the client reads them, a null
+// value is "<null>"
+struct Encoded {
+    std::vector<Oid> oids;
+    std::vector<std::vector<std::string>> rows;
+};
+
+static Encoded encode_query(Connection &conn, std::string const &query,
+                            FormatCode format_code) {
+    auto result = conn.Query(query);
+    INFO(query);
+    REQUIRE_FALSE(result->HasError());
+
+    Encoded encoded;
+    ResultEncoder encoder;
+    for (idx_t i = 0; i < result->types.size(); i++) {
+        encoded.oids.push_back(encoder.add_column(i, result->types[i]));
+    }
+
+    pgwire::Bytes data;
+    pgwire::Writer writer{
+        result->types.size(),
+        [&data](pgwire::Bytes &rows) {
+            data.insert(data.end(), rows.begin(), rows.end());
+            return true;
+        },
+        0,
+        {format_code}};
+    while (auto chunk = result->Fetch()) {
+        if (chunk->size() == 0) {
+            break;
+        }
+        REQUIRE(encoder.encode(*chunk, writer));
+    }
+
+    pgwire::BufferView view{data.data(), data.size()};
+    while (view.size() > 0) {
+        REQUIRE(view.get_numeric<int8_t>() == 'D');
+        view.get_numeric<int32_t>();
+
+        auto &row = encoded.rows.emplace_back();
+        auto num_cols = view.get_numeric<int16_t>();
+        for (int16_t i = 0; i < num_cols; i++) {
+            auto len = view.get_numeric<int32_t>();
+            row.emplace_back(len < 0 ? "<null>" : view.get_bytes(len));
+        }
+    }
+    return encoded;
+}
+
+static std::string bytes(std::vector<int> const &v) {
+    return std::string(v.begin(), v.end());
+}
+
+TEST_CASE("Values are encoded by their type", "[encoder]") {
+    struct Case {
+        char const *expr;
+        Oid oid;
+        std::string text;
+        std::string binary;
+    };
+
+    // numerics are ndigits, weight, sign and dscale, then base 10000 digits
+    std::vector<Case> cases = {
+        {"true", Oid::Bool, "t", bytes({1})},
+        {"(-5)::TINYINT", Oid::Int2, "-5", bytes({0xff, 0xfb})},
+        {"200::UTINYINT", Oid::Int2, "200", bytes({0, 200})},
+        {"(-300)::SMALLINT", Oid::Int2, "-300", bytes({0xfe, 0xd4})},
+        {"60000::USMALLINT", Oid::Int4, "60000", bytes({0, 0, 0xea, 0x60})},
+        {"(-70000)::INTEGER", Oid::Int4, "-70000",
+         bytes({0xff, 0xfe, 0xee, 0x90})},
+        {"4000000000::UINTEGER", Oid::Int8, "4000000000",
+         bytes({0, 0, 0, 0, 0xee, 0x6b, 0x28, 0})},
+        {"(-5000000000)::BIGINT", Oid::Int8, "-5000000000",
+         bytes({0xff, 0xff, 0xff, 0xfe, 0xd5, 0xfa, 0x0e, 0})},
+        {"12345678::UBIGINT", Oid::Numeric, "12345678",
+         bytes({0, 2, 0, 1, 0, 0, 0, 0, 0x04, 0xd2, 0x16, 0x2e})},
+        {"(-12345678)::HUGEINT", Oid::Numeric, "-12345678",
+         bytes({0, 2, 0, 1, 0x40, 0, 0, 0, 0x04, 0xd2, 0x16, 0x2e})},
+        {"123.4::DECIMAL(4,1)", Oid::Numeric, "123.4",
+         bytes({0, 2, 0, 0, 0, 0, 0, 1, 0, 0x7b, 0x0f, 0xa0})},
+        {"(-1.5)::DECIMAL(9,2)", Oid::Numeric, "-1.50",
+         bytes({0, 2, 0, 0, 0x40, 0, 0, 2, 0, 1, 0x13, 0x88})},
+        {"0.005::DECIMAL(18,3)", Oid::Numeric, "0.005",
+         bytes({0, 1, 0xff, 0xff, 0, 0, 0, 3, 0, 0x32})},
+        {"1.0001::DECIMAL(38,4)", Oid::Numeric, "1.0001",
+         bytes({0, 2, 0, 0, 0, 0, 0, 4, 0, 1, 0, 1})},
+        {"0.5::FLOAT", Oid::Float4, "0.5", bytes({0x3f, 0, 0, 0})},
+        {"0.1::DOUBLE", Oid::Float8, "0.1",
+         bytes({0x3f, 0xb9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a})},
+        {"'hello'", Oid::Varchar, "hello", "hello"},
+        {"'\\xAA\\x01'::BLOB", Oid::Bytea, "\\xaa01", bytes({0xaa, 0x01})},
+        {"'a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11'::UUID", Oid::Uuid,
+         "a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11",
+         bytes({0xa0, 0xee, 0xbc, 0x99, 0x9c, 0x0b, 0x4e, 0xf8, 0xbb, 0x6d,
+                0x6b, 0xb9, 0xbd, 0x38, 0x0a, 0x11})},
+        {"DATE '2024-02-29'", Oid::Date, "2024-02-29",
+         bytes({0, 0, 0x22, 0x79})},
+        {"TIME '13:45:00.25'", Oid::Time, "13:45:00.25",
+         bytes({0, 0, 0, 0x0b, 0x86, 0x71, 0xdf, 0x90})},
+        {"TIMESTAMP '2000-01-01 00:00:00.5'", Oid::Timestamp,
+         "2000-01-01 00:00:00.5", bytes({0, 0, 0, 0, 0, 0x07, 0xa1, 0x20})},
+        {"TIMESTAMPTZ '2024-02-29 00:00:00+00'", Oid::TimestampTz,
+         "2024-02-29 00:00:00+00",
+         bytes({0, 0x02, 0xb5, 0x78, 0xb5, 0x8c, 0x60, 0})},
+        {"INTERVAL '1 year 2 months 3 days 04:05:06'", Oid::Interval,
+         "1 year 2 mons 3 days 04:05:06",
+         bytes({0, 0, 0, 0x03, 0x6c, 0x8b, 0xc0, 0x80, 0, 0, 0, 3, 0, 0, 0,
+                14})},
+        // ndim, has null, element oid, size and lower bound, then the
+        // elements
+        {"[1, NULL, 3]", Oid::Int4Array, "{1,NULL,3}",
+         bytes({0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 23, 0, 0, 0, 3, 0, 0, 0, 1,
+                0, 0, 0, 4, 0, 0, 0, 1, 0xff, 0xff, 0xff, 0xff,
+                0, 0, 0, 4, 0, 0, 0, 3})},
+        // number of fields, then oid, length and value of each
+        {"{'a': 42, 'b': 'x y'}", Oid::Record, "(42,\"x y\")",
+         bytes({0, 0, 0, 2, 0, 0, 0, 23, 0, 0, 0, 4, 0, 0, 0, 42,
+                0, 0, 0x04, 0x13, 0, 0, 0, 3, 'x', ' ', 'y'})},
+    };
+
+    DuckDB db(nullptr);
+    Connection conn(db);
+    for (auto &c : cases) {
+        // the constant column goes through the values encoded once per
+        // chunk, the other one is flat and ends with a null
+        auto query = pgwire::string_format(
+            "SELECT %s, CASE WHEN i = 0 THEN %s END FROM range(2) t(i)",
+            c.expr, c.expr);
+        INFO(query);
+
+        auto text = encode_query(conn, query, FormatCode::Text);
+        REQUIRE(text.oids == std::vector<Oid>{c.oid, c.oid});
+        REQUIRE(text.rows == std::vector<std::vector<std::string>>{
+                                 {c.text, c.text}, {c.text, "<null>"}});
+
+        auto binary = encode_query(conn, query, FormatCode::Binary);
+        REQUIRE(binary.oids == text.oids);
+        REQUIRE(binary.rows == std::vector<std::vector<std::string>>{
+                                   {c.binary, c.binary},
+                                   {c.binary, "<null>"}});
+    }
+}
+
+TEST_CASE("Types without an encoder are sent as text", "[encoder]") {
+    DuckDB db(nullptr);
+    Connection conn(db);
+
+    // postgres arrays are rectangular so lists of lists have no encoder,
+    // neither have maps, both are sent the way DuckDB prints them
+    for (auto expr : {"[[1, 2], [3]]", "MAP {'k': 1}"}) {
+        auto query = std::string("SELECT ") + expr + ", 7";
+        INFO(query);
+        auto printed = conn.Query(query)->GetValue(0, 0).ToString();
+
+        for (auto format_code : {FormatCode::Text, FormatCode::Binary}) {
+            auto encoded = encode_query(conn, query, format_code);
+            REQUIRE(encoded.oids == std::vector<Oid>{Oid::Text, Oid::Int4});
+            REQUIRE(encoded.rows.size() == 1);
+            REQUIRE(encoded.rows[0][0] == printed);
+        }
+    }
+
+    auto encoded = encode_query(conn, "SELECT NULL::INTEGER[][]",
+                                FormatCode::Text);
+    REQUIRE(encoded.rows ==
+            std::vector<std::vector<std::string>>{{"<null>"}});
+}
@@ -0,0 +1,215 @@
+// Measures how many rows per second are encoded as DataRows, comparing the
+// per value path the extension used to take with the ResultEncoder. The
+// result is materialized upfront so only the encoding is timed. The report
+// part encodes a chunk of constant and dictionary vectors against a flat
+// copy of it.
+//
+//   duckpg-encoder-benchmark [rows] [text|binary]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+
+#include <duckdb.hpp>
+#include <duckpg/encoder.hpp>
+#include <pgwire/utils.hpp>
+#include <pgwire/writer.hpp>
+
+using namespace duckdb;
+
+static const char *kQuery = "SELECT i::SMALLINT AS c0, i::INTEGER AS c1, "
+                            "i AS c2, i::FLOAT AS c3, i::DOUBLE / 3 AS c4, "
+                            "'row ' || i AS c5, "
+                            "DATE '2000-01-01' + (i % 10000)::INTEGER AS c6, "
+                            "TIMESTAMP '2000-01-01' + to_seconds(i) AS c7, "
+                            "CASE WHEN i % 10 = 0 THEN NULL ELSE i END AS c8, "
+                            "(i % 7)::INTEGER AS c9 "
+                            "FROM range(%lld) t(i)";
+
+static std::unordered_set<LogicalTypeId> g_supported = {
+    LogicalTypeId::SMALLINT, LogicalTypeId::INTEGER, LogicalTypeId::BIGINT,
+    LogicalTypeId::FLOAT,    LogicalTypeId::DOUBLE,  LogicalTypeId::VARCHAR,
+    LogicalTypeId::DATE,     LogicalTypeId::TIMESTAMP,
+};
+
+// the row at a time loop the extension had before the ResultEncoder
+static void encode_by_value(ColumnDataCollection &collection,
+                            vector<LogicalType> const &types,
+                            pgwire::Writer &writer) {
+    for (auto &chunk : collection.Chunks()) {
+        for (idx_t row_idx = 0; row_idx < chunk.size(); row_idx++) {
+            writer.flush();
+            auto row = writer.add_row();
+
+            for (idx_t i = 0; i < types.size(); i++) {
+                auto &type = types[i];
+                if (g_supported.find(type.id()) == g_supported.end()) {
+                    continue;
+                }
+
+                auto value = chunk.GetValue(i, row_idx);
+                if (value.IsNull()) {
+                    row.write_null();
+                    continue;
+                }
+
+                switch (type.id()) {
+                case LogicalTypeId::SMALLINT:
+                    row.write_int2(value.GetValue<int16_t>());
+                    break;
+                case LogicalTypeId::INTEGER:
+                    row.write_int4(value.GetValue<int32_t>());
+                    break;
+                case LogicalTypeId::BIGINT:
+                    row.write_int8(value.GetValue<int64_t>());
+                    break;
+                case LogicalTypeId::FLOAT:
+                    row.write_float4(value.GetValue<float>());
+                    break;
+                case LogicalTypeId::DOUBLE:
+                    row.write_float8(value.GetValue<double>());
+                    break;
+                default:
+                    row.write_string(value.GetValue<std::string>());
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void encode_by_vector(ColumnDataCollection &collection,
+                             vector<LogicalType> const &types,
+                             pgwire::Writer &writer) {
+    ResultEncoder encoder;
+    for (idx_t i = 0; i < types.size(); i++) {
+        encoder.add_column(i, types[i]);
+    }
+
+    for (auto &chunk : collection.Chunks()) {
+        encoder.encode(chunk, writer);
+    }
+}
+
+template <typename Encode>
+static void run(char const *name, MaterializedQueryResult &result,
+                pgwire::FormatCode format_code, Encode &&encode) {
+    std::size_t bytes = 0;
+    pgwire::Writer writer{
+        result.types.size(),
+        [&bytes](pgwire::Bytes const &data) {
+            bytes += data.size();
+            return true;
+        },
+        1024 * 64,
+        {format_code}};
+
+    auto start = std::chrono::steady_clock::now();
+    encode(result.Collection(), result.types, writer);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    auto rows = writer.num_rows();
+    std::printf("%-10s %12zu rows %8.3fs %14.0f rows/s %10.1f MiB\n", name,
+                rows, elapsed.count(), rows / elapsed.count(),
+                bytes / (1024.0 * 1024.0));
+}
+
+// a chunk like a report grouped by category, labels and ids come from small
+// dictionaries, literal projections are constants and the measures are flat
+static void make_report_chunk(DataChunk &chunk) {
+    vector<LogicalType> types(6, LogicalType::VARCHAR);
+    types.insert(types.end(), 2, LogicalType::BIGINT);
+    types.insert(types.end(), 2, LogicalType::DOUBLE);
+    chunk.Initialize(Allocator::DefaultAllocator(), types);
+
+    idx_t count = STANDARD_VECTOR_SIZE;
+    idx_t num_labels = 8;
+    SelectionVector sel(count);
+    for (idx_t i = 0; i < count; i++) {
+        sel.set_index(i, i % num_labels);
+    }
+
+    for (idx_t col = 0; col < 8; col++) {
+        if (col == 4 || col == 5) {
+            chunk.data[col].Reference(Value("annual report 2024"));
+            continue;
+        }
+
+        Vector dictionary(types[col], num_labels);
+        for (idx_t i = 0; i < num_labels; i++) {
+            dictionary.SetValue(
+                i, types[col].id() == LogicalTypeId::VARCHAR
+                       ? Value(pgwire::string_format("category %d", int(i)))
+                       : Value::BIGINT(int64_t(i) * 1000003));
+        }
+        chunk.data[col].Slice(dictionary, sel, count);
+    }
+
+    for (idx_t i = 0; i < count; i++) {
+        chunk.data[8].SetValue(i, Value::DOUBLE(double(i) * 1.5));
+        chunk.data[9].SetValue(i, Value::DOUBLE(double(i) / 7));
+    }
+    chunk.SetCardinality(count);
+}
+
+static void run_report(char const *name, DataChunk &chunk, long long num_rows,
+                       pgwire::FormatCode format_code) {
+    std::size_t bytes = 0;
+    pgwire::Writer writer{
+        chunk.ColumnCount(),
+        [&bytes](pgwire::Bytes const &data) {
+            bytes += data.size();
+            return true;
+        },
+        1024 * 64,
+        {format_code}};
+
+    ResultEncoder encoder;
+    for (idx_t i = 0; i < chunk.ColumnCount(); i++) {
+        encoder.add_column(i, chunk.data[i].GetType());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (long long rows = 0; rows < num_rows; rows += chunk.size()) {
+        encoder.encode(chunk, writer);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    auto rows = writer.num_rows();
+    std::printf("%-10s %12zu rows %8.3fs %14.0f rows/s %10.1f MiB\n", name,
+                rows, elapsed.count(), rows / elapsed.count(),
+                bytes / (1024.0 * 1024.0));
+}
+
+int main(int argc, char **argv) {
+    long long num_rows = argc > 1 ? std::atoll(argv[1]) : 10000000;
+    auto format_code = argc > 2 && std::strcmp(argv[2], "binary") == 0
+                           ? pgwire::FormatCode::Binary
+                           : pgwire::FormatCode::Text;
+
+    DuckDB db(nullptr);
+    Connection conn(db);
+
+    auto result = conn.Query(pgwire::string_format(kQuery, num_rows));
+    if (result->HasError()) {
+        std::fprintf(stderr, "%s\n", result->GetError().c_str());
+        return 1;
+    }
+
+    run("value", *result, format_code, encode_by_value);
+    run("vector", *result, format_code, encode_by_vector);
+
+    DataChunk report, flat;
+    make_report_chunk(report);
+    flat.Initialize(Allocator::DefaultAllocator(), report.GetTypes());
+    report.Copy(flat);
+
+    run_report("flat", flat, num_rows, format_code);
+    run_report("repeated", report, num_rows, format_code);
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include <catch2/catch.hpp>
+
+#include <duckpg/handler.hpp>
+#include <pgwire/exception.hpp>
+
+using namespace duckdb;
+using namespace std::chrono_literals;
+
+static pgwire::SqlState timeout_error(std::string_view query) {
+    try {
+        statement_timeout(query);
+    } catch (pgwire::SqlException &e) {
+        return e.get_sqlstate();
+    }
+    FAIL("no error for " << query);
+    return pgwire::SqlState::SuccessfulCompletion;
+}
+
+TEST_CASE("SET statement_timeout is parsed", "[handler]") {
+    REQUIRE(statement_timeout("SET statement_timeout = 1500") == 1500ms);
+    REQUIRE(statement_timeout("set statement_timeout to '5s';") == 5000ms);
+    REQUIRE(statement_timeout("SET SESSION statement_timeout = '2 min'") ==
+            120000ms);
+    REQUIRE(statement_timeout("SET statement_timeout = '10ms'") == 10ms);
+    REQUIRE(statement_timeout("SET statement_timeout = DEFAULT") == 0ms);
+    REQUIRE(statement_timeout("RESET statement_timeout") == 0ms);
+    REQUIRE(statement_timeout("SET statement_timeout = 2147483647") ==
+            2147483647ms);
+
+    REQUIRE_FALSE(statement_timeout("SELECT 1"));
+    REQUIRE_FALSE(statement_timeout("SET search_path = main"));
+}
+
+TEST_CASE("Bad statement_timeout values are rejected", "[handler]") {
+    using pgwire::SqlState;
+
+    REQUIRE(timeout_error("SET statement_timeout = 'abc'") ==
+            SqlState::InvalidParameterValue);
+    REQUIRE(timeout_error("SET statement_timeout = '5 hours'") ==
+            SqlState::InvalidParameterValue);
+    REQUIRE(timeout_error("SET statement_timeout = ''") ==
+            SqlState::InvalidParameterValue);
+    REQUIRE(timeout_error("SET statement_timeout = -1") ==
+            SqlState::InvalidParameterValue);
+
+    // too large for the digits, the scaled value and PostgreSQL's limit
+    REQUIRE(timeout_error("SET statement_timeout = 99999999999999999999999") ==
+            SqlState::InvalidParameterValue);
+    REQUIRE(timeout_error("SET statement_timeout = '9223372036854775807min'") ==
+            SqlState::InvalidParameterValue);
+    REQUIRE(timeout_error("SET statement_timeout = 2147483648") ==
+            SqlState::InvalidParameterValue);
+    REQUIRE(timeout_error("SET statement_timeout = '35792min'") ==
+            SqlState::InvalidParameterValue);
+}
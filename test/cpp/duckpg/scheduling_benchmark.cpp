@@ -0,0 +1,182 @@
+// Measures the latency of light queries while a few heavy ones keep running,
+// comparing the worker pool with stepping the queries on the I/O threads.
+// Every client is a blocking socket on its own thread, the light clients
+// loop on a trivial query and record its round trip, the heavy clients loop
+// on a large aggregate. The server has no way to stop its I/O threads, so
+// run the benchmark once per mode.
+//
+//   duckpg-scheduling-benchmark [workers|stepping] [light clients]
+//                               [heavy clients] [seconds] [io threads]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <duckdb.hpp>
+#include <duckpg/handler.hpp>
+#include <pgwire/server.hpp>
+
+using namespace duckdb;
+using asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+static const char *kLightQuery = "SELECT 42";
+static const char *kHeavyQuery =
+    "SELECT sum(i * i % 7), count(DISTINCT i % 100003) FROM range(50000000) "
+    "t(i)";
+
+static void put_int32(std::string &out, int32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(char((v >> shift) & 0xff));
+    }
+}
+
+static std::string message(char tag, std::string const &body) {
+    std::string out(1, tag);
+    put_int32(out, int32_t(body.size() + 4));
+    return out + body;
+}
+
+// reads messages until ReadyForQuery, returns false on an ErrorResponse
+static bool read_until_ready(tcp::socket &socket, std::vector<char> &buf) {
+    bool ok = true;
+    for (;;) {
+        char header[5];
+        asio::read(socket, asio::buffer(header));
+        uint32_t len = (uint8_t(header[1]) << 24) | (uint8_t(header[2]) << 16) |
+                       (uint8_t(header[3]) << 8) | uint8_t(header[4]);
+        buf.resize(std::max<std::size_t>(buf.size(), len));
+        asio::read(socket, asio::buffer(buf.data(), len - 4));
+        ok = ok && header[0] != 'E';
+        if (header[0] == 'Z') {
+            return ok;
+        }
+    }
+}
+
+static tcp::socket open_session(asio::io_context &io_context,
+                                unsigned short port) {
+    tcp::socket socket{io_context};
+    for (int attempt = 0;; attempt++) {
+        asio::error_code err;
+        socket.connect(tcp::endpoint(asio::ip::address_v4::loopback(), port),
+                       err);
+        if (!err) {
+            break;
+        }
+        if (attempt == 100) {
+            std::fprintf(stderr, "connect failed: %s\n",
+                         err.message().c_str());
+            std::exit(1);
+        }
+        socket = tcp::socket{io_context};
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    socket.set_option(tcp::no_delay(true));
+
+    std::vector<char> buf(4096);
+    std::string startup;
+    put_int32(startup, 0);
+    put_int32(startup, 3 << 16);
+    startup += std::string("user\0bench\0\0", 12);
+    startup[3] = char(startup.size());
+    asio::write(socket, asio::buffer(startup));
+    read_until_ready(socket, buf);
+    return socket;
+}
+
+int main(int argc, char **argv) {
+    auto mode = argc > 1 && std::strcmp(argv[1], "stepping") == 0
+                    ? ExecutionMode::Stepping
+                    : ExecutionMode::Workers;
+    int num_light = argc > 2 ? std::atoi(argv[2]) : 64;
+    int num_heavy = argc > 3 ? std::atoi(argv[3]) : 4;
+    int seconds = argc > 4 ? std::atoi(argv[4]) : 10;
+    std::size_t num_threads = argc > 5 ? std::atoi(argv[5]) : 2;
+    unsigned short port = 15434;
+
+    DuckDB db(nullptr);
+    asio::io_context io_context;
+    asio::thread_pool workers(
+        std::max(std::thread::hardware_concurrency(), 1u));
+    pgwire::Server server(
+        io_context, tcp::endpoint(asio::ip::address_v4::loopback(), port),
+        pgwire::AsyncHandler([&](pgwire::Session &session) {
+            return duckdb_handler(*db.instance, session, workers, mode);
+        }),
+        num_threads);
+    std::thread([&] { server.start(); }).detach();
+
+    std::atomic<bool> stop = false;
+    std::atomic<std::size_t> heavy_done = 0;
+    std::vector<std::vector<double>> latencies(num_light);
+    std::vector<std::thread> clients;
+
+    for (int i = 0; i < num_heavy; i++) {
+        clients.emplace_back([&] {
+            asio::io_context client_context;
+            auto socket = open_session(client_context, port);
+            auto query = message('Q', std::string(kHeavyQuery) + '\0');
+            std::vector<char> buf(4096);
+            while (!stop) {
+                asio::write(socket, asio::buffer(query));
+                if (read_until_ready(socket, buf)) {
+                    heavy_done++;
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < num_light; i++) {
+        clients.emplace_back([&, i] {
+            asio::io_context client_context;
+            auto socket = open_session(client_context, port);
+            auto query = message('Q', std::string(kLightQuery) + '\0');
+            std::vector<char> buf(4096);
+            auto &samples = latencies[i];
+            while (!stop) {
+                auto start = Clock::now();
+                asio::write(socket, asio::buffer(query));
+                read_until_ready(socket, buf);
+                std::chrono::duration<double, std::milli> elapsed =
+                    Clock::now() - start;
+                samples.push_back(elapsed.count());
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (auto &client : clients) {
+        client.join();
+    }
+
+    std::vector<double> all;
+    for (auto &samples : latencies) {
+        all.insert(all.end(), samples.begin(), samples.end());
+    }
+    std::sort(all.begin(), all.end());
+    auto at = [&](double q) {
+        return all.empty() ? 0.0 : all[std::size_t(q * (all.size() - 1))];
+    };
+
+    std::printf("%s, %d light and %d heavy clients, %zu I/O threads\n",
+                mode == ExecutionMode::Stepping ? "stepping" : "workers",
+                num_light, num_heavy, num_threads);
+    std::printf("light      %8.0f queries/s  p50 %8.3f ms  p99 %8.3f ms  "
+                "p99.9 %8.3f ms  max %8.3f ms\n",
+                all.size() / double(seconds), at(0.5), at(0.99), at(0.999),
+                all.empty() ? 0.0 : all.back());
+    std::printf("heavy      %8.2f queries/s\n",
+                heavy_done.load() / double(seconds));
+
+    // the server's threads are still running
+    std::fflush(stdout);
+    std::quick_exit(0);
+}
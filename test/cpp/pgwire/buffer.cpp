@@ -0,0 +1,238 @@
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <pgwire/buffer.hpp>
+#include <pgwire/exception.hpp>
+
+using namespace pgwire;
+
+TEST_CASE("Buffer puts values in network order", "[buffer]") {
+    Buffer b;
+    b.put_byte('T')
+        .put_numeric<int32_t>(0x01020304)
+        .put_numeric<int16_t>(-2)
+        .put_string("ab")
+        .put_string("cd", false);
+
+    Bytes expected = {'T', 1, 2, 3, 4, 0xff, 0xfe, 'a', 'b', 0, 'c', 'd'};
+    REQUIRE(b.data() == expected);
+
+    REQUIRE(b.get_numeric<uint8_t>() == 'T');
+    REQUIRE(b.get_numeric<int32_t>() == 0x01020304);
+    REQUIRE(b.get_numeric<int16_t>() == -2);
+    REQUIRE(b.get_string() == "ab");
+}
+
+TEST_CASE("Strings without a null are protocol violations", "[buffer]") {
+    Buffer b;
+    b.put_string("ab").put_string("cd", false);
+    auto bytes = b.data();
+    BufferView view{bytes.data(), bytes.size()};
+
+    REQUIRE(b.get_string() == "ab");
+    try {
+        b.get_string();
+        FAIL("read a string without a null");
+    } catch (SqlException &e) {
+        REQUIRE(e.get_sqlstate() == SqlState::ProtocolViolation);
+    }
+
+    REQUIRE(view.get_string() == "ab");
+    try {
+        view.get_string();
+        FAIL("read a string without a null");
+    } catch (SqlException &e) {
+        REQUIRE(e.get_sqlstate() == SqlState::ProtocolViolation);
+    }
+}
+
+TEST_CASE("Buffer patches and extends in place", "[buffer]") {
+    Buffer b;
+    b.put_numeric<int32_t>(0);
+    b.put_string("", false);
+
+    auto p = b.extend(8);
+    std::fill(p, p + 8, Byte('x'));
+    b.truncate(4 + 3);
+    b.set_numeric<int32_t>(0, int32_t(b.data().size()));
+
+    Bytes expected = {0, 0, 0, 7, 'x', 'x', 'x'};
+    REQUIRE(b.data() == expected);
+
+    // truncate never grows
+    b.truncate(100);
+    REQUIRE(b.data().size() == 7);
+}
+
+TEST_CASE("Buffer grows geometrically", "[buffer]") {
+    Buffer b;
+    std::size_t reallocations = 0;
+    auto capacity = b.data().capacity();
+    for (int i = 0; i < 100000; i++) {
+        b.reserve(3);
+        b.put_bytes(reinterpret_cast<Byte const *>("abc"), 3);
+        if (b.data().capacity() != capacity) {
+            capacity = b.data().capacity();
+            reallocations++;
+        }
+    }
+
+    REQUIRE(b.data().size() == 300000);
+    REQUIRE(reallocations < 32);
+}
+
+TEST_CASE("BufferPool recycles chunks on the thread", "[buffer]") {
+    // drain what previous tests left behind
+    while (BufferPool::available() > 0) {
+        BufferPool::acquire();
+    }
+
+    auto b = Buffer::pooled(1024);
+    REQUIRE(b.data().capacity() >= 1024);
+    b.put_string("hello");
+    auto bytes = b.take_bytes();
+    auto storage = bytes.data();
+
+    BufferPool::release(std::move(bytes));
+    REQUIRE(BufferPool::available() == 1);
+
+    // the same storage comes back empty
+    auto again = Buffer::pooled();
+    REQUIRE(BufferPool::available() == 0);
+    REQUIRE(again.data().empty());
+    REQUIRE(again.data().data() == storage);
+
+    // oversized chunks are dropped
+    BufferPool::release(Bytes(BufferPool::kMaxChunkSize + 1));
+    REQUIRE(BufferPool::available() == 0);
+
+    for (std::size_t i = 0; i < BufferPool::kMaxChunks + 8; i++) {
+        BufferPool::release(Bytes(16));
+    }
+    REQUIRE(BufferPool::available() == BufferPool::kMaxChunks);
+}
+
+TEST_CASE("BufferArena keeps what a query needs", "[buffer]") {
+    while (BufferPool::available() > 0) {
+        BufferPool::acquire();
+    }
+
+    BufferArena arena;
+    // a query with three messages in flight at once
+    std::vector<Bytes> messages;
+    for (int i = 0; i < 3; i++) {
+        messages.push_back(arena.acquire(100));
+    }
+    for (auto &bytes : messages) {
+        arena.release(std::move(bytes));
+    }
+    messages.clear();
+    arena.reset();
+
+    auto const &stats = arena.stats();
+    REQUIRE(stats.acquired == 3);
+    REQUIRE(stats.reused == 0);
+    REQUIRE(stats.in_use == 0);
+    REQUIRE(stats.high_water == 3);
+    REQUIRE(stats.retained_bytes >= 300);
+    REQUIRE(stats.resets == 1);
+
+    // the next query of a single message reuses a chunk, the other two go
+    // back to the thread's pool on reset
+    arena.release(arena.acquire());
+    arena.reset();
+    REQUIRE(stats.acquired == 4);
+    REQUIRE(stats.reused == 1);
+    REQUIRE(stats.reuse_rate() == Approx(0.25));
+    REQUIRE(BufferPool::available() == 2);
+
+    // chunks still referenced elsewhere are only counted as released
+    auto held = arena.acquire();
+    arena.release({});
+    REQUIRE(stats.in_use == 0);
+    REQUIRE(stats.reused == 2);
+    REQUIRE(held.capacity() > 0);
+}
+
+// the previous implementation, appending byte by byte and reserving the exact
+// size on every call
+class NaiveBuffer {
+  public:
+    template <typename T> void put_numeric(T v) {
+        T buffer = 0;
+        endian::network::put(v, reinterpret_cast<uint8_t *>(&buffer));
+        auto pointer = reinterpret_cast<uint8_t *>(&buffer);
+        std::copy(pointer, pointer + sizeof(T), std::back_inserter(_data));
+    }
+
+    void put_bytes(Byte const *b, std::size_t size) {
+        _data.reserve(size + _data.size());
+        std::copy(b, b + size, std::back_inserter(_data));
+    }
+
+    std::size_t size() const { return _data.size(); }
+
+  private:
+    Bytes _data;
+};
+
+// a DataRow with a few short columns, the typical shape of a result
+template <typename B> std::size_t encode_rows(B &b, int rows) {
+    static std::string const kValue = "some text value";
+    auto value = reinterpret_cast<Byte const *>(kValue.data());
+    for (int i = 0; i < rows; i++) {
+        b.template put_numeric<int8_t>('D');
+        b.template put_numeric<int32_t>(0);
+        b.template put_numeric<int16_t>(4);
+        b.template put_numeric<int32_t>(8);
+        b.template put_numeric<int64_t>(i);
+        b.template put_numeric<int32_t>(4);
+        b.template put_numeric<int32_t>(i);
+        b.template put_numeric<int32_t>(int32_t(kValue.size()));
+        b.put_bytes(value, kValue.size());
+        b.template put_numeric<int32_t>(-1);
+    }
+    return b.size();
+}
+
+TEST_CASE("Buffer benchmark", "[.][benchmark]") {
+    constexpr int kRows = 10000;
+
+    BENCHMARK("Buffer rows") {
+        Buffer b;
+        return encode_rows(b, kRows);
+    };
+    BENCHMARK("naive rows") {
+        NaiveBuffer b;
+        return encode_rows(b, kRows);
+    };
+
+    BENCHMARK("Buffer small messages") {
+        std::size_t total = 0;
+        for (int i = 0; i < 1000; i++) {
+            Buffer b;
+            b.put_numeric<uint8_t>('Z');
+            b.put_numeric<int32_t>(5);
+            b.put_numeric<uint8_t>('I');
+            total += b.take_bytes().size();
+        }
+        return total;
+    };
+    BENCHMARK("pooled small messages") {
+        std::size_t total = 0;
+        for (int i = 0; i < 1000; i++) {
+            auto b = Buffer::pooled();
+            b.put_numeric<uint8_t>('Z');
+            b.put_numeric<int32_t>(5);
+            b.put_numeric<uint8_t>('I');
+            auto bytes = b.take_bytes();
+            total += bytes.size();
+            BufferPool::release(std::move(bytes));
+        }
+        return total;
+    };
+}
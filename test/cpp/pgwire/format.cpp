@@ -0,0 +1,399 @@
+#include <catch2/catch.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+
+#include <pgwire/format.hpp>
+
+using namespace pgwire;
+
+template <typename T, typename Format>
+static std::string format(Format f, T v) {
+    char buf[kMaxNumericTextSize];
+    return std::string(buf, f(buf, v));
+}
+
+static std::string f4(float v) { return format(format_float4, v); }
+static std::string f8(double v) { return format(format_float8, v); }
+
+TEST_CASE("Integer text formatting", "[format]") {
+    REQUIRE(format(format_int2, int16_t(0)) == "0");
+    REQUIRE(format(format_int2, int16_t(-7)) == "-7");
+    REQUIRE(format(format_int2, int16_t(32767)) == "32767");
+    REQUIRE(format(format_int2, int16_t(-32768)) == "-32768");
+    REQUIRE(format(format_int4, int32_t(10)) == "10");
+    REQUIRE(format(format_int4, int32_t(100)) == "100");
+    REQUIRE(format(format_int4, std::numeric_limits<int32_t>::max()) ==
+            "2147483647");
+    REQUIRE(format(format_int4, std::numeric_limits<int32_t>::min()) ==
+            "-2147483648");
+    REQUIRE(format(format_int8, std::numeric_limits<int64_t>::max()) ==
+            "9223372036854775807");
+    REQUIRE(format(format_int8, std::numeric_limits<int64_t>::min()) ==
+            "-9223372036854775808");
+
+    // every length and the boundaries between them
+    int64_t v = 1;
+    for (int i = 1; i < 19; i++, v *= 10) {
+        REQUIRE(format(format_int8, v) == std::to_string(v));
+        REQUIRE(format(format_int8, v - 1) == std::to_string(v - 1));
+        REQUIRE(format(format_int8, -v) == std::to_string(-v));
+    }
+
+    std::mt19937_64 rng(42);
+    for (int i = 0; i < 100000; i++) {
+        auto x = int64_t(rng()) >> (rng() % 64);
+        REQUIRE(format(format_int8, x) == std::to_string(x));
+    }
+}
+
+// expected values are taken from postgres 15 with the default settings
+TEST_CASE("Float8 text follows postgres output", "[format]") {
+    REQUIRE(f8(0.0) == "0");
+    REQUIRE(f8(-0.0) == "-0");
+    REQUIRE(f8(1.0) == "1");
+    REQUIRE(f8(-1.5) == "-1.5");
+    REQUIRE(f8(0.1) == "0.1");
+    REQUIRE(f8(0.1 + 0.2) == "0.30000000000000004");
+    REQUIRE(f8(1.0 / 3) == "0.3333333333333333");
+    REQUIRE(f8(3.141592653589793) == "3.141592653589793");
+    REQUIRE(f8(0.0001) == "0.0001");
+    REQUIRE(f8(0.00001) == "1e-05");
+    REQUIRE(f8(0.000123) == "0.000123");
+    REQUIRE(f8(0.0000123) == "1.23e-05");
+    REQUIRE(f8(123456789012345.0) == "123456789012345");
+    REQUIRE(f8(100000000000000.0) == "100000000000000");
+    REQUIRE(f8(1e15) == "1e+15");
+    REQUIRE(f8(1234567890123456.0) == "1.234567890123456e+15");
+    REQUIRE(f8(1e100) == "1e+100");
+    REQUIRE(f8(1.7976931348623157e308) == "1.7976931348623157e+308");
+    REQUIRE(f8(5e-324) == "5e-324");
+    REQUIRE(f8(std::numeric_limits<double>::quiet_NaN()) == "NaN");
+    REQUIRE(f8(std::numeric_limits<double>::infinity()) == "Infinity");
+    REQUIRE(f8(-std::numeric_limits<double>::infinity()) == "-Infinity");
+}
+
+TEST_CASE("Float4 text follows postgres output", "[format]") {
+    REQUIRE(f4(0.0f) == "0");
+    REQUIRE(f4(-0.0f) == "-0");
+    REQUIRE(f4(0.1f) == "0.1");
+    REQUIRE(f4(1.0f / 3) == "0.33333334");
+    REQUIRE(f4(3.1415927f) == "3.1415927");
+    REQUIRE(f4(0.0001f) == "0.0001");
+    REQUIRE(f4(0.00001f) == "1e-05");
+    REQUIRE(f4(123456.0f) == "123456");
+    REQUIRE(f4(100000.0f) == "100000");
+    REQUIRE(f4(1e6f) == "1e+06");
+    REQUIRE(f4(1234567.0f) == "1.234567e+06");
+    REQUIRE(f4(3.4028235e38f) == "3.4028235e+38");
+    REQUIRE(f4(1e-45f) == "1e-45");
+    REQUIRE(f4(std::numeric_limits<float>::quiet_NaN()) == "NaN");
+    REQUIRE(f4(std::numeric_limits<float>::infinity()) == "Infinity");
+    REQUIRE(f4(-std::numeric_limits<float>::infinity()) == "-Infinity");
+}
+
+// the notation only depends on the decimal exponent of the value
+static void require_notation(std::string const &text, int exponent,
+                             int max_exponent) {
+    bool scientific = text.find('e') != std::string::npos;
+    REQUIRE(scientific == (exponent < -4 || exponent >= max_exponent));
+}
+
+TEST_CASE("Float text reads back to the same value", "[format]") {
+    std::mt19937_64 rng(42);
+
+    for (int i = 0; i < 100000; i++) {
+        double v;
+        uint64_t bits = rng();
+        std::memcpy(&v, &bits, sizeof(v));
+        if (!std::isfinite(v)) {
+            continue;
+        }
+
+        auto text = f8(v);
+        double parsed = std::strtod(text.c_str(), nullptr);
+        REQUIRE(std::memcmp(&parsed, &v, sizeof(v)) == 0);
+        if (v != 0) {
+            char sci[64];
+            std::snprintf(sci, sizeof(sci), "%.16e", v);
+            require_notation(text, std::atoi(std::strchr(sci, 'e') + 1), 15);
+        }
+    }
+
+    for (int i = 0; i < 100000; i++) {
+        float v;
+        auto bits = uint32_t(rng());
+        std::memcpy(&v, &bits, sizeof(v));
+        if (!std::isfinite(v)) {
+            continue;
+        }
+
+        auto text = f4(v);
+        float parsed = std::strtof(text.c_str(), nullptr);
+        REQUIRE(std::memcmp(&parsed, &v, sizeof(v)) == 0);
+    }
+
+    // values around the notation boundaries
+    for (double v : {9.9999e-5, 1e-4, 99999999999999.9, 999999999999999.0,
+                     1e15 - 1}) {
+        auto text = f8(v);
+        REQUIRE(std::strtod(text.c_str(), nullptr) == v);
+    }
+}
+
+TEST_CASE("Numeric text formatting benchmark", "[.][benchmark]") {
+    std::mt19937_64 rng(42);
+    std::vector<int64_t> ints(4096);
+    std::vector<double> doubles(4096);
+    for (std::size_t i = 0; i < ints.size(); i++) {
+        ints[i] = int64_t(rng() >> (rng() % 64));
+        doubles[i] = double(rng() % 1000000) / 1000;
+    }
+
+    char buf[kMaxNumericTextSize + 256];
+    BENCHMARK("format_int8") {
+        std::size_t total = 0;
+        for (auto v : ints) {
+            total += format_int8(buf, v);
+        }
+        return total;
+    };
+    BENCHMARK("sprintf %lld") {
+        std::size_t total = 0;
+        for (auto v : ints) {
+            total += std::sprintf(buf, "%lld", (long long)v);
+        }
+        return total;
+    };
+    BENCHMARK("format_float8") {
+        std::size_t total = 0;
+        for (auto v : doubles) {
+            total += format_float8(buf, v);
+        }
+        return total;
+    };
+    BENCHMARK("sprintf %f") {
+        std::size_t total = 0;
+        for (auto v : doubles) {
+            total += std::sprintf(buf, "%f", v);
+        }
+        return total;
+    };
+}
+
+static std::string date(int32_t days) { return format(format_date, days); }
+static std::string tod(int64_t micros) { return format(format_time, micros); }
+static std::string ts(int64_t micros) {
+    return format(format_timestamp, micros);
+}
+static std::string tstz(int64_t micros) {
+    return format(format_timestamptz, micros);
+}
+static std::string interval(int32_t months, int32_t days, int64_t micros) {
+    char buf[kMaxTemporalTextSize];
+    return std::string(buf, format_interval(buf, months, days, micros));
+}
+
+constexpr int64_t kSecond = 1000000;
+constexpr int64_t kDay = 86400 * kSecond;
+
+TEST_CASE("Date and time text follows postgres ISO style", "[format]") {
+    REQUIRE(date(0) == "1970-01-01");
+    REQUIRE(date(10957) == "2000-01-01");
+    REQUIRE(date(19782) == "2024-02-29");
+    REQUIRE(date(-1) == "1969-12-31");
+    REQUIRE(date(-719162) == "0001-01-01");
+    REQUIRE(date(-719163) == "0001-12-31 BC");
+    REQUIRE(date(-735160) == "0044-03-15 BC");
+    REQUIRE(date(2932897) == "10000-01-01");
+    REQUIRE(date(std::numeric_limits<int32_t>::max()) == "infinity");
+    REQUIRE(date(-std::numeric_limits<int32_t>::max()) == "-infinity");
+
+    REQUIRE(tod(0) == "00:00:00");
+    REQUIRE(tod(49500 * kSecond + 250000) == "13:45:00.25");
+    REQUIRE(tod(kDay - 1) == "23:59:59.999999");
+    REQUIRE(tod(kDay) == "24:00:00");
+    REQUIRE(tod(1) == "00:00:00.000001");
+}
+
+TEST_CASE("Timestamp text follows postgres ISO style", "[format]") {
+    REQUIRE(ts(0) == "1970-01-01 00:00:00");
+    REQUIRE(ts(946684800 * kSecond + 500000) == "2000-01-01 00:00:00.5");
+    REQUIRE(ts(-1) == "1969-12-31 23:59:59.999999");
+    REQUIRE(ts(-735160 * kDay + 12 * 3600 * kSecond) ==
+            "0044-03-15 12:00:00 BC");
+    REQUIRE(ts(std::numeric_limits<int64_t>::max()) == "infinity");
+    REQUIRE(ts(-std::numeric_limits<int64_t>::max()) == "-infinity");
+
+    REQUIRE(tstz(1709164800 * kSecond) == "2024-02-29 00:00:00+00");
+    REQUIRE(tstz(-735160 * kDay) == "0044-03-15 00:00:00+00 BC");
+}
+
+TEST_CASE("Interval text follows postgres style", "[format]") {
+    REQUIRE(interval(0, 0, 0) == "00:00:00");
+    REQUIRE(interval(14, 3, (4 * 3600 + 5 * 60 + 6) * kSecond) ==
+            "1 year 2 mons 3 days 04:05:06");
+    REQUIRE(interval(1, 1, 0) == "1 mon 1 day");
+    REQUIRE(interval(-14, 0, 0) == "-1 years -2 mons");
+    REQUIRE(interval(0, -2, -1500000) == "-2 days -00:00:01.5");
+    REQUIRE(interval(0, -1, 3600 * kSecond) == "-1 days +01:00:00");
+    REQUIRE(interval(-1, 2, 0) == "-1 mons +2 days");
+    REQUIRE(interval(0, 0, 100 * 3600 * kSecond) == "100:00:00");
+    REQUIRE(interval(std::numeric_limits<int32_t>::min(),
+                     std::numeric_limits<int32_t>::min(),
+                     std::numeric_limits<int64_t>::min()) ==
+            "-178956970 years -8 mons -2147483648 days "
+            "-2562047788:00:54.775808");
+}
+
+static std::string decimal(Int128 v, uint8_t scale) {
+    char buf[kMaxDecimalTextSize];
+    return std::string(buf, format_decimal(buf, v, scale));
+}
+
+static Int128 int128(int64_t v) { return {uint64_t(v), v < 0 ? -1 : 0}; }
+
+TEST_CASE("Numeric text keeps the scale", "[format]") {
+    REQUIRE(decimal(int128(0), 0) == "0");
+    REQUIRE(decimal(int128(0), 2) == "0.00");
+    REQUIRE(decimal(int128(150), 2) == "1.50");
+    REQUIRE(decimal(int128(-150), 2) == "-1.50");
+    REQUIRE(decimal(int128(5), 3) == "0.005");
+    REQUIRE(decimal(int128(-5), 3) == "-0.005");
+    REQUIRE(decimal(int128(123456789), 0) == "123456789");
+    REQUIRE(decimal(int128(std::numeric_limits<int64_t>::min()), 0) ==
+            "-9223372036854775808");
+    // 10^38 - 1, the largest DECIMAL(38, x)
+    Int128 max{0x098a223fffffffffull, 0x4b3b4ca85a86c47a};
+    REQUIRE(decimal(max, 0) == std::string(38, '9'));
+    REQUIRE(decimal(max, 38) == "0." + std::string(38, '9'));
+    REQUIRE(decimal({0, std::numeric_limits<int64_t>::min()}, 0) ==
+            "-170141183460469231731687303715884105728");
+    REQUIRE(decimal({~0ull, std::numeric_limits<int64_t>::max()}, 0) ==
+            "170141183460469231731687303715884105727");
+}
+
+struct BinaryNumeric {
+    int16_t weight;
+    uint16_t sign;
+    int16_t dscale;
+    std::vector<int16_t> digits;
+};
+
+static BinaryNumeric binary(Int128 v, uint8_t scale) {
+    Byte buf[kMaxDecimalBinarySize];
+    auto len = encode_decimal(buf, v, scale);
+    auto get = [&](std::size_t offset) {
+        return int16_t(buf[offset] << 8 | buf[offset + 1]);
+    };
+
+    BinaryNumeric result{get(2), uint16_t(get(4)), get(6), {}};
+    REQUIRE(len == 8 + std::size_t(get(0)) * 2);
+    for (std::size_t i = 8; i < len; i += 2) {
+        result.digits.push_back(get(i));
+    }
+    return result;
+}
+
+TEST_CASE("Numeric binary uses base 10000 digits", "[format]") {
+    auto zero = binary(int128(0), 2);
+    REQUIRE(zero.digits.empty());
+    REQUIRE(zero.weight == 0);
+    REQUIRE(zero.sign == 0);
+    REQUIRE(zero.dscale == 2);
+
+    auto n = binary(int128(123456), 1);
+    REQUIRE(n.digits == std::vector<int16_t>{1, 2345, 6000});
+    REQUIRE(n.weight == 1);
+    REQUIRE(n.dscale == 1);
+
+    n = binary(int128(-150), 2);
+    REQUIRE(n.digits == std::vector<int16_t>{1, 5000});
+    REQUIRE(n.weight == 0);
+    REQUIRE(n.sign == 0x4000);
+
+    n = binary(int128(1), 4);
+    REQUIRE(n.digits == std::vector<int16_t>{1});
+    REQUIRE(n.weight == -1);
+
+    n = binary(int128(1), 5);
+    REQUIRE(n.digits == std::vector<int16_t>{1000});
+    REQUIRE(n.weight == -2);
+
+    n = binary(int128(100000000), 0);
+    REQUIRE(n.digits == std::vector<int16_t>{1});
+    REQUIRE(n.weight == 2);
+
+    // every digit group reads back to the text of the same value
+    std::mt19937_64 rng(42);
+    for (int i = 0; i < 10000; i++) {
+        Int128 v{rng(), int64_t(rng()) >> (rng() % 64)};
+        auto scale = uint8_t(rng() % 39);
+        auto text = decimal(v, scale);
+        n = binary(v, scale);
+
+        std::string digits;
+        for (auto d : n.digits) {
+            char group[8];
+            std::snprintf(group, sizeof(group), "%04d", d);
+            digits += group;
+        }
+        // digits of the text without the sign, point and leading zeros
+        std::string expected;
+        for (auto c : text) {
+            if (c >= '0' && c <= '9' && !(expected.empty() && c == '0')) {
+                expected += c;
+            }
+        }
+        auto trimmed = digits.substr(digits.find_first_not_of('0'));
+        trimmed.erase(trimmed.find_last_not_of('0') + 1);
+        expected.erase(expected.find_last_not_of('0') + 1);
+        REQUIRE(trimmed == expected);
+        REQUIRE(n.sign == (text[0] == '-' ? 0x4000 : 0));
+        REQUIRE(n.dscale == scale);
+
+        // the weight places the first group relative to the point
+        std::size_t begin = text[0] == '-';
+        auto integral = text.substr(begin, text.find('.') - begin);
+        if (integral != "0") {
+            REQUIRE(n.weight == int16_t((integral.size() + 3) / 4 - 1));
+        } else {
+            REQUIRE(n.weight < 0);
+        }
+    }
+}
+
+TEST_CASE("Uuid and hex text", "[format]") {
+    Byte bytes[16] = {0x55, 0x0e, 0x84, 0x00, 0xe2, 0x9b, 0x41, 0xd4,
+                      0xa7, 0x16, 0x44, 0x66, 0x55, 0x44, 0x00, 0x00};
+    char buf[kUuidTextSize];
+    REQUIRE(std::string(buf, format_uuid(buf, bytes)) ==
+            "550e8400-e29b-41d4-a716-446655440000");
+
+    char hex[8];
+    Byte data[] = {0x00, 0xff, 0x10, 0xab};
+    format_hex(hex, data, sizeof(data));
+    REQUIRE(std::string(hex, sizeof(hex)) == "00ff10ab");
+}
+
+TEST_CASE("Temporal text formatting benchmark", "[.][benchmark]") {
+    std::mt19937_64 rng(42);
+    std::vector<int64_t> timestamps(4096);
+    for (auto &v : timestamps) {
+        v = int64_t(rng() % (100ull * 365 * kDay)) - 30ll * 365 * kDay;
+    }
+
+    char buf[kMaxTemporalTextSize];
+    BENCHMARK("format_timestamp") {
+        std::size_t total = 0;
+        for (auto v : timestamps) {
+            total += format_timestamp(buf, v);
+        }
+        return total;
+    };
+}
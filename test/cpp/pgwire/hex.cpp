@@ -0,0 +1,101 @@
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <pgwire/format.hpp>
+
+using namespace pgwire;
+
+static std::vector<HexKernel> const kKernels = {
+    HexKernel::Scalar, HexKernel::Sse2, HexKernel::Avx2};
+
+static char const *kernel_name(HexKernel kernel) {
+    switch (kernel) {
+    case HexKernel::Scalar:
+        return "scalar";
+    case HexKernel::Sse2:
+        return "sse2";
+    case HexKernel::Avx2:
+        return "avx2";
+    }
+    return "";
+}
+
+static std::string expected_hex(Byte const *data, std::size_t size) {
+    std::string result;
+    for (std::size_t i = 0; i < size; i++) {
+        char buf[3];
+        std::snprintf(buf, sizeof(buf), "%02x", data[i]);
+        result += buf;
+    }
+    return result;
+}
+
+TEST_CASE("Hex kernels encode every byte value", "[hex]") {
+    std::vector<Byte> data(256 + 67);
+    for (std::size_t i = 0; i < data.size(); i++) {
+        data[i] = Byte(i * 7);
+    }
+
+    for (auto kernel : kKernels) {
+        if (!hex_kernel_supported(kernel)) {
+            continue;
+        }
+        INFO(kernel_name(kernel));
+
+        // every length around the register sizes and unaligned starts
+        for (std::size_t offset = 0; offset < 3; offset++) {
+            for (std::size_t size = 0; size + offset <= data.size(); size++) {
+                std::string out(size * 2, '?');
+                format_hex(out.data(), data.data() + offset, size, kernel);
+                REQUIRE(out == expected_hex(data.data() + offset, size));
+            }
+        }
+    }
+
+    REQUIRE(hex_kernel_supported(hex_kernel()));
+    std::string out(data.size() * 2, '?');
+    format_hex(out.data(), data.data(), data.size());
+    REQUIRE(out == expected_hex(data.data(), data.size()));
+}
+
+TEST_CASE("Hex encoding benchmark", "[.][benchmark]") {
+    std::vector<Byte> data(1 << 20);
+    std::mt19937 rng(42);
+    for (auto &b : data) {
+        b = Byte(rng());
+    }
+    std::vector<char> out(data.size() * 2);
+    std::string throughput;
+
+    for (auto kernel : kKernels) {
+        if (!hex_kernel_supported(kernel)) {
+            continue;
+        }
+
+        auto name = std::string("hex ") + kernel_name(kernel) + " 1 MiB";
+        BENCHMARK(name.c_str()) {
+            format_hex(out.data(), data.data(), data.size(), kernel);
+            return out[0];
+        };
+
+        // throughput of the input bytes
+        constexpr int kIterations = 200;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kIterations; i++) {
+            format_hex(out.data(), data.data(), data.size(), kernel);
+        }
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        char line[64];
+        std::snprintf(line, sizeof(line), "%-8s %6.2f GB/s\n",
+                      kernel_name(kernel),
+                      kIterations * data.size() / elapsed.count() / 1e9);
+        throughput += line;
+    }
+    std::printf("\n%s", throughput.c_str());
+}
@@ -0,0 +1,519 @@
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pgwire/protocol.hpp>
+#include <pgwire/server.hpp>
+
+using namespace pgwire;
+
+using namespace std::string_literals;
+
+static Bytes to_bytes(Buffer &b) { return b.take_bytes(); }
+
+template <std::size_t N> static Bytes to_bytes(std::array<Byte, N> const &a) {
+    return Bytes(a.begin(), a.end());
+}
+
+// a message framed by hand around its raw body
+static Bytes framed(BackendTag tag, std::string const &body) {
+    Bytes b = {Byte(tag)};
+    auto length = uint32_t(4 + body.size());
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        b.push_back(Byte(length >> shift));
+    }
+    b.insert(b.end(), body.begin(), body.end());
+    return b;
+}
+
+static_assert(kParseComplete.size() == 5 && kParseComplete[4] == 4);
+static_assert(kAuthenticationOk[0] == 'R' && kAuthenticationOk[4] == 8);
+static_assert(ready_for_query(ReadyForQuery::Failed)[5] == 'E');
+
+TEST_CASE("Constant messages match their encoding", "[protocol]") {
+    REQUIRE(to_bytes(kAuthenticationOk) ==
+            framed(BackendTag::Authentication, "\0\0\0\0"s));
+    REQUIRE(to_bytes(kParseComplete) == framed(BackendTag::ParseComplete, ""));
+    REQUIRE(to_bytes(kBindComplete) == framed(BackendTag::BindComplete, ""));
+    REQUIRE(to_bytes(kCloseComplete) == framed(BackendTag::CloseComplete, ""));
+    REQUIRE(to_bytes(kNoData) == framed(BackendTag::NoData, ""));
+    REQUIRE(to_bytes(kPortalSuspended) ==
+            framed(BackendTag::PortalSuspended, ""));
+    REQUIRE(to_bytes(ready_for_query(ReadyForQuery::Idle)) ==
+            framed(BackendTag::ReadyForQuery, "I"));
+    REQUIRE(to_bytes(ready_for_query(ReadyForQuery::Block)) ==
+            framed(BackendTag::ReadyForQuery, "T"));
+    REQUIRE(to_bytes(ready_for_query(ReadyForQuery::Failed)) ==
+            framed(BackendTag::ReadyForQuery, "E"));
+}
+
+TEST_CASE("Messages are written from their fields", "[protocol]") {
+    Buffer b;
+    put_message(b, BackendTag::ParseComplete);
+    REQUIRE(to_bytes(b) == to_bytes(kParseComplete));
+
+    put_message(b, BackendTag::CommandComplete, "SELECT 42");
+    REQUIRE(to_bytes(b) ==
+            framed(BackendTag::CommandComplete, "SELECT 42\0"s));
+
+    std::string name = "TimeZone";
+    put_message(b, BackendTag::ParameterStatus, name, std::string_view("UTC"));
+    REQUIRE(to_bytes(b) ==
+            framed(BackendTag::ParameterStatus, "TimeZone\0UTC\0"s));
+
+    put_message(b, BackendTag::ErrorResponse, Byte('S'), "ERROR", Byte('C'),
+                "22000", Byte('M'), "failed", Byte(0));
+    REQUIRE(to_bytes(b) == framed(BackendTag::ErrorResponse,
+                                  "SERROR\0C22000\0Mfailed\0\0"s));
+
+    // integers are in network order
+    put_message(b, BackendTag::BackendKeyData, int32_t(42), int32_t(-7));
+    REQUIRE(to_bytes(b) == framed(BackendTag::BackendKeyData,
+                                  "\0\0\0\x2a\xff\xff\xff\xf9"s));
+
+    // name, table oid, column, type oid, type size, modifier and format
+    Fields fields = {{"a", Oid::Int4}, {"b", Oid::Text}};
+    std::vector<FormatCode> formats = {FormatCode::Binary, FormatCode::Text};
+    put_row_description(b, fields, formats);
+    REQUIRE(to_bytes(b) ==
+            framed(BackendTag::RowDescription,
+                   "\0\x02"
+                   "a\0" "\0\0\0\0" "\0\0" "\0\0\0\x17" "\0\x04"
+                   "\xff\xff\xff\xff" "\0\x01"
+                   "b\0" "\0\0\0\0" "\0\0" "\0\0\0\x19" "\xff\xff"
+                   "\xff\xff\xff\xff" "\0\0"s));
+
+    std::vector<Oid> types = {Oid::Int8, Oid::Varchar};
+    put_parameter_description(b, types);
+    REQUIRE(to_bytes(b) == framed(BackendTag::ParameterDescription,
+                                  "\0\x02\0\0\0\x14\0\0\x04\x13"s));
+}
+
+TEST_CASE("Startup packets are told apart by their version", "[protocol]") {
+    Buffer b;
+    b.put_numeric<int16_t>(1234).put_numeric<int16_t>(5678);
+    b.put_numeric<int32_t>(42).put_numeric<int32_t>(-7);
+    auto bytes = b.take_bytes();
+
+    BufferView view{bytes.data(), bytes.size()};
+    StartupMessage cancel;
+    cancel.decode(view);
+    REQUIRE(cancel.type() == FrontendType::CancelRequest);
+    REQUIRE(cancel.process_id == 42);
+    REQUIRE(cancel.secret_key == -7);
+
+    b.put_numeric<int16_t>(1234).put_numeric<int16_t>(5679);
+    bytes = b.take_bytes();
+    view = BufferView{bytes.data(), bytes.size()};
+    StartupMessage ssl;
+    ssl.decode(view);
+    REQUIRE(ssl.type() == FrontendType::SSLRequest);
+
+    b.put_numeric<int16_t>(3).put_numeric<int16_t>(0);
+    b.put_string("user").put_string("duck").put_string("");
+    bytes = b.take_bytes();
+    view = BufferView{bytes.data(), bytes.size()};
+    StartupMessage startup;
+    startup.decode(view);
+    REQUIRE(startup.type() == FrontendType::Startup);
+    REQUIRE(startup.user == "duck");
+}
+
+// decodes the body b holds into msg, the message keeps it as the session's
+// messages keep the receive buffer
+template <typename T> static void decode_body(Buffer &b, T &msg) {
+    auto bytes = std::make_shared<Bytes const>(b.take_bytes());
+    BufferView view{bytes->data(), bytes->size()};
+    msg.storage = bytes;
+    msg.decode(view);
+    REQUIRE(view.size() == 0);
+}
+
+TEST_CASE("Extended query messages are decoded", "[protocol]") {
+    Buffer b;
+    b.put_string("stmt").put_string("SELECT $1, $2");
+    b.put_numeric<int16_t>(2).put_numeric<oid_t>(23).put_numeric<oid_t>(0);
+    Parse parse;
+    decode_body(b, parse);
+    REQUIRE(parse.name == "stmt");
+    REQUIRE(parse.query == "SELECT $1, $2");
+    REQUIRE(parse.parameter_types == std::vector<oid_t>{23, 0});
+
+    // an int4 in binary and a null, every result column in binary
+    b.put_string("portal").put_string("stmt");
+    b.put_numeric<int16_t>(1).put_numeric<int16_t>(1);
+    b.put_numeric<int16_t>(2);
+    b.put_numeric<int32_t>(4).put_numeric<int32_t>(42);
+    b.put_numeric<int32_t>(-1);
+    b.put_numeric<int16_t>(1).put_numeric<int16_t>(1);
+    Bind bind;
+    decode_body(b, bind);
+    REQUIRE(bind.portal == "portal");
+    REQUIRE(bind.statement == "stmt");
+    REQUIRE(bind.parameter_formats ==
+            std::vector<FormatCode>{FormatCode::Binary});
+    REQUIRE(bind.parameters.size() == 2);
+    REQUIRE(bind.parameters[0] == std::string_view("\0\0\0\x2a", 4));
+    REQUIRE_FALSE(bind.parameters[1]);
+    REQUIRE(bind.result_formats == std::vector<FormatCode>{FormatCode::Binary});
+
+    b.put_numeric<Byte>('P').put_string("portal");
+    Describe describe;
+    decode_body(b, describe);
+    REQUIRE(describe.target == DescribeTarget::Portal);
+    REQUIRE(describe.name == "portal");
+
+    b.put_string("portal").put_numeric<int32_t>(100);
+    Execute execute;
+    decode_body(b, execute);
+    REQUIRE(execute.portal == "portal");
+    REQUIRE(execute.max_rows == 100);
+
+    b.put_numeric<Byte>('S').put_string("stmt");
+    Close close;
+    decode_body(b, close);
+    REQUIRE(close.target == DescribeTarget::Statement);
+    REQUIRE(close.name == "stmt");
+}
+
+TEST_CASE("Truncated messages are protocol violations", "[protocol]") {
+    Buffer b;
+    b.put_string("portal").put_numeric<int16_t>(0);
+    auto bytes = b.take_bytes();
+    BufferView view{bytes.data(), bytes.size()};
+    Execute execute;
+    try {
+        execute.decode(view);
+        FAIL("decoded a truncated Execute");
+    } catch (SqlException &e) {
+        REQUIRE(e.get_sqlstate() == SqlState::ProtocolViolation);
+    }
+
+    // a query that lost its null
+    b.put_string("SELECT 1", false);
+    bytes = b.take_bytes();
+    view = BufferView{bytes.data(), bytes.size()};
+    Query query;
+    try {
+        query.decode(view);
+        FAIL("decoded an unterminated Query");
+    } catch (SqlException &e) {
+        REQUIRE(e.get_sqlstate() == SqlState::ProtocolViolation);
+    }
+}
+
+// Received is a message the client received, its tag and body
+struct Received {
+    char tag;
+    std::string body;
+};
+
+// TestServer serves "rows <n>" with n rows of an int4 and a padding text,
+// by an asynchronous producer that waits while the result is not writable,
+// or by a synchronous handler
+class TestServer {
+  public:
+    explicit TestServer(bool async) {
+        // a free port of the loopback
+        auto loopback = asio::ip::address_v4::loopback();
+        asio::ip::tcp::acceptor probe{_io_context, {loopback, 0}};
+        _endpoint = probe.local_endpoint();
+        probe.close();
+
+        if (async) {
+            _server = std::make_unique<Server>(
+                _io_context, _endpoint,
+                [this](Session &session) -> AsyncParseHandler {
+                    _session = &session;
+                    return [](std::string_view query,
+                              Completion<PreparedStatement> done) {
+                        auto stmt = statement(query);
+                        auto n = rows_of(query);
+                        stmt.async_handler = [n](AsyncResultPtr result,
+                                                 Values const &) {
+                            produce(std::move(result), 0, n);
+                        };
+                        done.resolve(std::move(stmt));
+                    };
+                });
+        } else {
+            _server = std::make_unique<Server>(
+                _io_context, _endpoint,
+                [this](Session &session) -> ParseHandler {
+                    _session = &session;
+                    return [](std::string_view query) {
+                        auto stmt = statement(query);
+                        auto n = rows_of(query);
+                        stmt.handler = [n](Writer &writer, Values const &) {
+                            for (int i = 0; i < n; i++) {
+                                write_row(writer, i);
+                            }
+                        };
+                        return stmt;
+                    };
+                });
+        }
+        _thread = std::thread([this] { _server->start(); });
+    }
+
+    ~TestServer() {
+        _io_context.stop();
+        _thread.join();
+    }
+
+    asio::ip::tcp::endpoint endpoint() const { return _endpoint; }
+
+    // arena stats of the last session once it is idle, i.e. it holds no
+    // more than its receive buffer. The client may read the responses
+    // before the session is done with the write, so they are polled.
+    ArenaStats idle_arena_stats() {
+        for (int attempt = 0;; attempt++) {
+            std::promise<ArenaStats> promise;
+            asio::post(_session.load()->executor(), [&] {
+                promise.set_value(_session.load()->arena_stats());
+            });
+            auto stats = promise.get_future().get();
+            if (stats.in_use <= 1 || attempt == 100) {
+                return stats;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+  private:
+    static PreparedStatement statement(std::string_view query) {
+        PreparedStatement stmt;
+        stmt.fields = {{"n", Oid::Int4}, {"padding", Oid::Text}};
+        return stmt;
+    }
+
+    static int rows_of(std::string_view query) {
+        return std::atoi(std::string(query.substr(5)).c_str());
+    }
+
+    static void write_row(Writer &writer, int i) {
+        auto row = writer.add_row();
+        row.write_int4(i);
+        row.write_string(std::string(40, 'x'));
+    }
+
+    static void produce(AsyncResultPtr result, int from, int n) {
+        for (int i = from; i < n; i++) {
+            if (result->cancelled()) {
+                break;
+            }
+            if (!result->writable()) {
+                result->on_writable([result, i, n] { produce(result, i, n); });
+                return;
+            }
+            write_row(result->writer(), i);
+        }
+        result->finish();
+    }
+
+    asio::io_context _io_context;
+    asio::ip::tcp::endpoint _endpoint;
+    std::unique_ptr<Server> _server;
+    std::thread _thread;
+    std::atomic<Session *> _session = nullptr;
+};
+
+// Client is a blocking client of the server, it writes the messages of a
+// test and reads back the responses
+class Client {
+  public:
+    explicit Client(asio::ip::tcp::endpoint endpoint) : _socket(_io_context) {
+        for (int attempt = 0;; attempt++) {
+            asio::error_code err;
+            _socket.connect(endpoint, err);
+            if (!err) {
+                break;
+            }
+            REQUIRE(attempt < 100);
+            _socket = asio::ip::tcp::socket{_io_context};
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        Buffer b;
+        b.put_numeric<int32_t>(0).put_numeric<int32_t>(3 << 16);
+        b.put_string("user").put_string("test").put_string("");
+        auto bytes = b.take_bytes();
+        endian::network::put<int32_t>(int32_t(bytes.size()), bytes.data());
+        asio::write(_socket, asio::buffer(bytes));
+        read_until('Z');
+    }
+
+    Client &send(char tag, Buffer &body) {
+        auto bytes = body.take_bytes();
+        Buffer b;
+        b.put_numeric<Byte>(Byte(tag));
+        b.put_numeric<int32_t>(int32_t(bytes.size() + 4));
+        b.put_bytes(bytes);
+        bytes = b.take_bytes();
+        asio::write(_socket, asio::buffer(bytes));
+        return *this;
+    }
+
+    Client &parse(std::string_view name, std::string_view query) {
+        Buffer b;
+        b.put_string(name).put_string(query).put_numeric<int16_t>(0);
+        return send('P', b);
+    }
+
+    Client &bind(std::string_view portal, std::string_view statement) {
+        Buffer b;
+        b.put_string(portal).put_string(statement);
+        b.put_numeric<int16_t>(0).put_numeric<int16_t>(0);
+        b.put_numeric<int16_t>(0);
+        return send('B', b);
+    }
+
+    Client &execute(std::string_view portal, int32_t max_rows) {
+        Buffer b;
+        b.put_string(portal).put_numeric<int32_t>(max_rows);
+        return send('E', b);
+    }
+
+    Client &close_portal(std::string_view portal) {
+        Buffer b;
+        b.put_numeric<Byte>('P').put_string(portal);
+        return send('C', b);
+    }
+
+    Client &sync() {
+        Buffer b;
+        return send('S', b);
+    }
+
+    // reads the messages up to and including the first one tagged tag
+    std::vector<Received> read_until(char tag) {
+        std::vector<Received> messages;
+        for (;;) {
+            Byte header[5];
+            asio::read(_socket, asio::buffer(header));
+            auto len = endian::network::get<int32_t>(header + 1);
+            std::string body(len - 4, '\0');
+            asio::read(_socket, asio::buffer(body));
+            messages.push_back({char(header[0]), std::move(body)});
+            if (char(header[0]) == tag) {
+                return messages;
+            }
+        }
+    }
+
+  private:
+    asio::io_context _io_context;
+    asio::ip::tcp::socket _socket;
+};
+
+// tags of the messages, DataRows are counted instead
+static std::string summary(std::vector<Received> const &messages) {
+    std::string result;
+    std::size_t rows = 0;
+    for (auto const &msg : messages) {
+        if (msg.tag == 'D') {
+            rows++;
+            continue;
+        }
+        if (rows > 0) {
+            result += std::to_string(rows) + "D ";
+            rows = 0;
+        }
+        result += msg.tag;
+        if (msg.tag == 'C' || msg.tag == 'E') {
+            // the command tag, or the SQLSTATE of the error
+            auto code = msg.body.find("\0C", 0, 2);
+            result += "(" +
+                      (msg.tag == 'C' ? msg.body.substr(0, msg.body.size() - 1)
+                                      : msg.body.substr(code + 2, 5)) +
+                      ")";
+        }
+        result += ' ';
+    }
+    if (rows > 0) {
+        result += std::to_string(rows) + "D ";
+    }
+    return result;
+}
+
+TEST_CASE("Execute with max_rows suspends the portal", "[protocol]") {
+    for (bool async : {true, false}) {
+        INFO((async ? "asynchronous handler" : "synchronous handler"));
+        TestServer server{async};
+        Client client{server.endpoint()};
+
+        // the rows span several batches of the asynchronous producer
+        client.parse("", "rows 10000").bind("", "").execute("", 4000);
+        client.execute("", 4000).execute("", 4000).sync();
+        REQUIRE(summary(client.read_until('Z')) ==
+                "1 2 4000D s 4000D s 2000D C(SELECT 2000) Z ");
+
+        // the portal completes with its last rows once they are all produced
+        client.parse("", "rows 10").bind("", "").execute("", 5);
+        client.execute("", 5).sync();
+        REQUIRE(summary(client.read_until('Z')) ==
+                "1 2 5D s 5D C(SELECT 5) Z ");
+
+        // without a limit the rest is sent, a later Execute runs it again
+        client.parse("", "rows 10").bind("", "").execute("", 3);
+        client.execute("", 0).execute("", 0).sync();
+        REQUIRE(summary(client.read_until('Z')) ==
+                "1 2 3D s 7D C(SELECT 7) 10D C(SELECT 10) Z ");
+    }
+}
+
+TEST_CASE("Suspended portals can be closed", "[protocol]") {
+    TestServer server{true};
+    Client client{server.endpoint()};
+
+    client.parse("", "rows 100000").bind("cursor", "").execute("cursor", 10);
+    client.close_portal("cursor").execute("cursor", 10).sync();
+    REQUIRE(summary(client.read_until('Z')) == "1 2 10D s 3 E(34000) Z ");
+
+    // the session goes on with the next query
+    client.parse("", "rows 3").bind("", "").execute("", 0).sync();
+    REQUIRE(summary(client.read_until('Z')) == "1 2 3D C(SELECT 3) Z ");
+}
+
+TEST_CASE("Named portals are not replaced", "[protocol]") {
+    TestServer server{true};
+    Client client{server.endpoint()};
+
+    // messages after the error are skipped until Sync
+    client.parse("", "rows 5").bind("cursor", "").bind("cursor", "");
+    client.execute("cursor", 0).sync();
+    REQUIRE(summary(client.read_until('Z')) == "1 2 E(42P03) Z ");
+
+    // the unnamed portal is replaced by the next Bind
+    client.bind("", "").execute("", 2).bind("", "").execute("", 0).sync();
+    REQUIRE(summary(client.read_until('Z')) ==
+            "2 2D s 2 5D C(SELECT 5) Z ");
+
+    client.execute("cursor", 0).sync();
+    REQUIRE(summary(client.read_until('Z')) == "5D C(SELECT 5) Z ");
+}
+
+TEST_CASE("Streamed results keep the arena balanced", "[protocol]") {
+    TestServer server{true};
+    Client client{server.endpoint()};
+    auto before = server.idle_arena_stats();
+    REQUIRE(before.in_use == 1);
+
+    // a few megabytes of rows, sent in batches of the writer
+    client.parse("", "rows 100000").bind("", "").execute("", 0).sync();
+    REQUIRE(summary(client.read_until('Z')) ==
+            "1 2 100000D C(SELECT 100000) Z ");
+
+    // every batch was acquired from the arena before it was released
+    auto after = server.idle_arena_stats();
+    REQUIRE(after.in_use == 1);
+    REQUIRE(after.acquired - before.acquired >= 20);
+    REQUIRE(after.high_water > 2);
+}
@@ -0,0 +1,164 @@
+// Measures the round trip latency and the allocations per query of a session,
+// build it with and without PGWIRE_USE_COROUTINES to compare the coroutine
+// loop with the promise based one. A server with a single row result runs on
+// its own thread, the client is a blocking socket so it allocates nothing
+// while queries are timed.
+//
+//   pgwire-session-benchmark [queries] [port]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pgwire/server.hpp>
+
+static std::atomic<std::size_t> g_allocations = 0;
+
+void *operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+using asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+static void put_int32(std::string &out, int32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(char((v >> shift) & 0xff));
+    }
+}
+
+static std::string message(char tag, std::string const &body) {
+    std::string out(1, tag);
+    put_int32(out, int32_t(body.size() + 4));
+    return out + body;
+}
+
+// reads messages until ReadyForQuery, the buffer is reused across calls
+static void read_until_ready(tcp::socket &socket, std::vector<char> &buf) {
+    for (;;) {
+        char header[5];
+        asio::read(socket, asio::buffer(header));
+        uint32_t len = (uint8_t(header[1]) << 24) | (uint8_t(header[2]) << 16) |
+                       (uint8_t(header[3]) << 8) | uint8_t(header[4]);
+        buf.resize(std::max<std::size_t>(buf.size(), len));
+        asio::read(socket, asio::buffer(buf.data(), len - 4));
+        if (header[0] == 'Z') {
+            return;
+        }
+    }
+}
+
+static void report(char const *name, std::vector<double> &latencies,
+                   std::size_t allocations, std::size_t messages) {
+    std::sort(latencies.begin(), latencies.end());
+    auto at = [&](double q) {
+        return latencies[std::size_t(q * (latencies.size() - 1))];
+    };
+    double total = 0;
+    for (auto v : latencies) {
+        total += v;
+    }
+    std::printf("%-10s avg %7.2f us  p50 %7.2f us  p99 %7.2f us  "
+                "%.1f allocations per message\n",
+                name, total / latencies.size(), at(0.5), at(0.99),
+                double(allocations) / double(messages));
+}
+
+int main(int argc, char **argv) {
+    int queries = argc > 1 ? std::atoi(argv[1]) : 20000;
+    unsigned short port = argc > 2 ? std::atoi(argv[2]) : 15433;
+
+    asio::io_context io_context;
+    pgwire::Server server(
+        io_context, tcp::endpoint(asio::ip::address_v4::loopback(), port),
+        [](pgwire::Session &) {
+            return [](std::string_view) {
+                pgwire::PreparedStatement stmt;
+                stmt.fields = {{"n", pgwire::Oid::Int4}};
+                stmt.handler = [](pgwire::Writer &writer,
+                                  pgwire::Values const &) {
+                    writer.add_row().write_int4(1);
+                };
+                return stmt;
+            };
+        });
+    std::thread server_thread([&] { server.start(); });
+
+    tcp::socket socket{io_context};
+    for (int attempt = 0;; attempt++) {
+        asio::error_code err;
+        socket.connect(tcp::endpoint(asio::ip::address_v4::loopback(), port),
+                       err);
+        if (!err) {
+            break;
+        }
+        if (attempt == 100) {
+            std::fprintf(stderr, "connect failed: %s\n",
+                         err.message().c_str());
+            return 1;
+        }
+        socket = tcp::socket{io_context};
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    socket.set_option(tcp::no_delay(true));
+
+    std::vector<char> buf(4096);
+    std::string startup;
+    put_int32(startup, 0);
+    put_int32(startup, 3 << 16);
+    startup += std::string("user\0bench\0\0", 12);
+    startup[3] = char(startup.size());
+    asio::write(socket, asio::buffer(startup));
+    read_until_ready(socket, buf);
+
+    std::string simple = message('Q', std::string("SELECT 1\0", 9));
+    std::string extended =
+        message('P', std::string("\0SELECT 1\0\0\0", 12)) +
+        message('B', std::string("\0\0\0\0\0\0\0\0", 8)) +
+        message('E', std::string("\0\0\0\0\0", 5)) + message('S', "");
+
+    std::vector<double> latencies;
+    latencies.reserve(queries);
+    auto run = [&](char const *name, std::string const &request,
+                   std::size_t messages) {
+        latencies.clear();
+        auto allocations = g_allocations.load();
+        for (int i = 0; i < queries; i++) {
+            auto start = Clock::now();
+            asio::write(socket, asio::buffer(request));
+            read_until_ready(socket, buf);
+            std::chrono::duration<double, std::micro> elapsed =
+                Clock::now() - start;
+            latencies.push_back(elapsed.count());
+        }
+        report(name, latencies, g_allocations.load() - allocations,
+               std::size_t(queries) * messages);
+    };
+
+#ifdef PGWIRE_USE_COROUTINES
+    std::printf("coroutine session, %d queries\n", queries);
+#else
+    std::printf("promise session, %d queries\n", queries);
+#endif
+    run("simple", simple, 1);
+    run("extended", extended, 4);
+
+    asio::write(socket, asio::buffer(message('X', "")));
+    socket.close();
+    io_context.stop();
+    server_thread.join();
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include <catch2/catch.hpp>
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <pgwire/writer.hpp>
+
+using namespace pgwire;
+
+// the values of the single DataRow written by the writer
+static std::vector<std::string> values(Writer const &writer) {
+    Buffer b;
+    encode(b, writer);
+    auto &data = b.data();
+
+    std::vector<std::string> result;
+    // tag, length and the number of columns
+    std::size_t pos = 7;
+    while (pos < data.size()) {
+        auto len = int32_t(data[pos] << 24 | data[pos + 1] << 16 |
+                           data[pos + 2] << 8 | data[pos + 3]);
+        pos += 4;
+        if (len < 0) {
+            result.push_back("<null>");
+            continue;
+        }
+        result.emplace_back(reinterpret_cast<char const *>(&data[pos]), len);
+        pos += len;
+    }
+    return result;
+}
+
+static std::string bytes(std::vector<int> const &v) {
+    return std::string(v.begin(), v.end());
+}
+
+TEST_CASE("Text arrays and records", "[writer]") {
+    Writer writer{3};
+    {
+        auto row = writer.add_row();
+        row.begin_array(Oid::Int4);
+        row.write_int4(1);
+        row.write_null();
+        row.write_int4(-3);
+        row.end_array();
+
+        row.begin_array(Oid::Varchar);
+        row.write_string("plain");
+        row.write_string("with space");
+        row.write_string("q\"b\\");
+        row.write_string("");
+        row.write_string("null");
+        row.end_array();
+
+        row.begin_record();
+        row.record_field(Oid::Int4);
+        row.write_int4(42);
+        row.record_field(Oid::Varchar);
+        row.write_null();
+        row.record_field(Oid::Varchar);
+        row.write_string("a\"b");
+        row.record_field(Oid::Int4Array);
+        row.begin_array(Oid::Int4);
+        row.write_int4(1);
+        row.write_int4(2);
+        row.end_array();
+        row.end_record();
+    }
+
+    auto result = values(writer);
+    REQUIRE(result.size() == 3);
+    REQUIRE(result[0] == "{1,NULL,-3}");
+    REQUIRE(result[1] ==
+            "{plain,\"with space\",\"q\\\"b\\\\\",\"\",\"null\"}");
+    REQUIRE(result[2] == "(42,,\"a\"\"b\",\"{1,2}\")");
+}
+
+TEST_CASE("Binary arrays and records", "[writer]") {
+    Writer writer{
+        3, [](Bytes const &) { return true; }, 1 << 20, {FormatCode::Binary}};
+    {
+        auto row = writer.add_row();
+        row.begin_array(Oid::Int2);
+        row.write_int2(1);
+        row.write_null();
+        row.end_array();
+
+        row.begin_array(Oid::Int8);
+        row.end_array();
+
+        row.begin_record();
+        row.record_field(Oid::Int2);
+        row.write_int2(7);
+        row.end_record();
+    }
+
+    auto result = values(writer);
+    REQUIRE(result.size() == 3);
+    // ndim, has null, element oid, size and lower bound, then the elements
+    REQUIRE(result[0] == bytes({0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 21,
+                                0, 0, 0, 2, 0, 0, 0, 1,
+                                0, 0, 0, 2, 0, 1, 0xff, 0xff, 0xff, 0xff}));
+    REQUIRE(result[1] == bytes({0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 20}));
+    // number of fields, then oid, length and value of each
+    REQUIRE(result[2] ==
+            bytes({0, 0, 0, 1, 0, 0, 0, 21, 0, 0, 0, 2, 0, 7}));
+}
+
+TEST_CASE("Binary dates and timestamps", "[writer]") {
+    Writer writer{
+        6, [](Bytes const &) { return true; }, 1 << 20, {FormatCode::Binary}};
+    {
+        auto row = writer.add_row();
+        row.write_date(10957);
+        row.write_date(std::numeric_limits<int32_t>::max());
+        row.write_date(-std::numeric_limits<int32_t>::max());
+        row.write_timestamp(946684800000001);
+        row.write_timestamp(std::numeric_limits<int64_t>::max());
+        row.write_timestamp(-std::numeric_limits<int64_t>::max());
+    }
+
+    auto result = values(writer);
+    REQUIRE(result.size() == 6);
+    // shifted to the postgres epoch, 2000-01-01
+    REQUIRE(result[0] == bytes({0, 0, 0, 0}));
+    // DuckDB's infinities become the int max and min postgres uses
+    REQUIRE(result[1] == bytes({0x7f, 0xff, 0xff, 0xff}));
+    REQUIRE(result[2] == bytes({0x80, 0, 0, 0}));
+    REQUIRE(result[3] == bytes({0, 0, 0, 0, 0, 0, 0, 1}));
+    REQUIRE(result[4] ==
+            bytes({0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}));
+    REQUIRE(result[5] == bytes({0x80, 0, 0, 0, 0, 0, 0, 0}));
+}
+
+TEST_CASE("Rows are flushed once they reach the threshold", "[writer]") {
+    std::vector<std::size_t> batches;
+    bool sent = true;
+    Writer writer{1,
+                  [&](Bytes const &data) {
+                      batches.push_back(data.size());
+                      return sent;
+                  },
+                  30};
+
+    // a DataRow of 1 column with a 4 bytes value is 15 bytes
+    writer.add_row().write_string("abcd");
+    REQUIRE(writer.flush());
+    REQUIRE(batches.empty());
+
+    // finishing the row flushes it, the producer doesn't have to
+    writer.add_row().write_string("abcd");
+    REQUIRE(batches == std::vector<std::size_t>{30});
+    REQUIRE(values(writer).empty());
+
+    sent = false;
+    writer.add_row().write_string("abcd");
+    writer.add_row().write_string("abcd");
+    REQUIRE_FALSE(writer.flush());
+    REQUIRE(batches.size() == 2);
+
+    // the rows written once they can't be sent are dropped
+    writer.add_row().write_string("abcd");
+    writer.add_row().write_string("abcd");
+    REQUIRE_FALSE(writer.flush());
+    REQUIRE(batches.size() == 2);
+    REQUIRE(values(writer).empty());
+    REQUIRE(writer.num_rows() == 6);
+}
+
+TEST_CASE("Rows affected default to the rows written", "[writer]") {
+    Writer writer{1};
+    writer.add_row().write_int4(1);
+    writer.add_row().write_int4(2);
+    REQUIRE(writer.rows_affected() == 2);
+
+    Writer changed{0};
+    changed.set_rows_affected(42);
+    REQUIRE(changed.num_rows() == 0);
+    REQUIRE(changed.rows_affected() == 42);
+}